@@ -0,0 +1,30 @@
+# - Try to find libvmaf
+# Once done this will define
+#
+# VMAF_FOUND - system has libvmaf
+# VMAF_INCLUDE_DIR - the libvmaf include directory
+# VMAF_LIBRARY - Link this to use libvmaf
+#
+
+include(FindPackageHandleStandardArgs)
+
+find_package(PkgConfig)
+if(PKG_CONFIG_FOUND)
+  pkg_check_modules(_VMAF libvmaf)
+endif()
+
+find_path(VMAF_INCLUDE_DIR
+  NAMES libvmaf/libvmaf.h
+  PATHS ${_VMAF_INCLUDE_DIRS}
+    /usr/include
+    /usr/local/include
+    /opt/local/include)
+
+find_library(VMAF_LIBRARY
+  NAMES vmaf
+  PATHS ${_VMAF_LIBRARY_DIRS}
+    /usr/lib
+    /usr/local/lib
+    /opt/local/lib)
+
+find_package_handle_standard_args(VMAF DEFAULT_MSG VMAF_LIBRARY VMAF_INCLUDE_DIR)
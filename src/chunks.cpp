@@ -0,0 +1,209 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunks.h"
+#include "ivf.h"
+#include "passcache.h"
+#include "process.h"
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <stdio.h>
+#include <thread>
+
+namespace {
+    // The time budget of a trial shared by all of its chunks: cpu time adds up over the chunks, real time
+    // is the longest chunk. Once the total is over the budget, or the trial is cancelled, every chunk is stopped.
+    class chunkBudget {
+    public:
+        chunkBudget(size_t count, double budget, bool cpuTime, const std::atomic<bool> *cancel) :
+            finished(count, 0), running(count, 0), budget(budget), cpuTime(cpuTime), cancel(cancel), stop(false) {}
+
+        bool keepRunning(size_t chunk, double seconds)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            running.at(chunk) = seconds;
+            double total = 0;
+            for (size_t i = 0; i < finished.size(); i++) {
+                double t = finished.at(i) + running.at(i);
+                total = cpuTime ? total + t : std::max(total, t);
+            }
+            if ((budget > 0 && total > budget) || (cancel && *cancel))
+                stop = true;
+            return !stop;
+        }
+
+        void passDone(size_t chunk, double seconds)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            finished.at(chunk) += seconds;
+            running.at(chunk) = 0;
+        }
+
+        bool stopped() const { return stop; }
+
+    private:
+        std::mutex lock;
+        std::vector<double> finished;
+        std::vector<double> running;
+        double budget;
+        bool cpuTime;
+        const std::atomic<bool> *cancel;
+        std::atomic<bool> stop;
+    };
+
+    struct chunkResult {
+        bool ok = false;
+        bool stopped = false;
+        bool firstPassCached = false;
+        runner::processUsage usageP1;
+        runner::processUsage usageP2;
+        double realTime = 0;
+        std::vector<uint8_t> output;
+    };
+
+    void encodeChunk(const runner::singleRun &part, const runner::runSettings &rs, const runner::trialContext &ctx,
+                     bool twoRuns, const std::string &trialPassFile, size_t index, chunkBudget *budget, chunkResult &result)
+    {
+        auto start = std::chrono::steady_clock::now();
+        runner::processWatch watch;
+        watch.keepRunning = [&] (double cpuSeconds, double realSeconds) -> bool {
+            return budget->keepRunning(index, rs.useCPUTime ? cpuSeconds : realSeconds);
+        };
+        const runner::processWatch *w = budget ? &watch : nullptr;
+        std::string passFile = trialPassFile;
+        std::string passKey = runner::firstPassCache::key(part);
+        runner::firstPassEntry cachedPass;
+        result.firstPassCached = twoRuns && ctx.passCache && ctx.passCache->lookup(passKey, cachedPass);
+        double cachedTime = 0;
+
+        if (result.firstPassCached) {
+            passFile = cachedPass.passFile;
+            result.usageP1 = cachedPass.usage;
+            cachedTime = cachedPass.realTime;
+            if (budget)
+                budget->passDone(index, rs.useCPUTime ? result.usageP1.cpuTime() : cachedTime);
+        } else if (twoRuns) {
+            auto passStart = std::chrono::steady_clock::now();
+            int status = runner::runCommand(runner::encoderCommand(part, rs, passFile, "/dev/null", 1), result.usageP1, rs.countHardwareEvents, w);
+            double passTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - passStart).count();
+            if (status == runner::commandStopped || (budget && budget->stopped())) {
+                result.stopped = true;
+                result.ok = true;
+                result.realTime = passTime;
+                remove(trialPassFile.c_str());
+                return;
+            }
+            if (status != 0)
+                return;
+            if (budget)
+                budget->passDone(index, rs.useCPUTime ? result.usageP1.cpuTime() : passTime);
+            if (ctx.passCache)
+                passFile = ctx.passCache->store(passKey, passFile, result.usageP1, passTime);
+        }
+
+        runner::processUsage usage;
+        int status = runner::runCommand(runner::encoderCommand(part, rs, passFile, "-", twoRuns ? 2 : 0), usage, [&] (const uint8_t *data, size_t size) {
+            result.output.insert(result.output.end(), data, data + size);
+        }, rs.countHardwareEvents, w);
+        if (twoRuns)
+            result.usageP2 = usage;
+        else
+            result.usageP1 = usage;
+        if (twoRuns && passFile == trialPassFile)
+            remove(trialPassFile.c_str());
+
+        result.realTime = cachedTime + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.stopped = status == runner::commandStopped;
+        result.ok = status == 0 || result.stopped;
+    }
+}
+
+std::vector<long> runner::chunkStarts(const std::vector<long> &sceneCuts, long frames, int count, long minLength)
+{
+    std::vector<long> starts(1, 0);
+    minLength = std::max(1L, minLength);
+    count = (int) std::min((long) count, frames / minLength);
+    if (count <= 1)
+        return starts;
+
+    long length = frames / count;
+    for (int k = 1; k < count; k++) {
+        long ideal = k * frames / count;
+        long best = ideal;
+        long bestDistance = length / 4 + 1;
+        for (size_t i = 0; i < sceneCuts.size(); i++) {
+            long distance = std::abs(sceneCuts.at(i) - ideal);
+            if (distance < bestDistance) {
+                best = sceneCuts.at(i);
+                bestDistance = distance;
+            }
+        }
+        if (best - starts.back() >= minLength && frames - best >= minLength)
+            starts.push_back(best);
+    }
+    return starts;
+}
+
+bool runner::encodeChunks(singleRun &sr, const runSettings &rs, const trialContext &ctx, bool twoRuns, std::vector<uint8_t> &joined,
+                          const std::atomic<bool> *cancel)
+{
+    size_t count = rs.chunkStarts.size();
+    std::vector<chunkResult> results(count);
+    chunkBudget budget(count, sr.timeBudget, rs.useCPUTime, cancel);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; i++) {
+        singleRun part = sr;
+        part.frameOffset = rs.chunkStarts.at(i);
+        part.frameLimit = (i + 1 < count ? rs.chunkStarts.at(i + 1) : rs.videoFrames) - part.frameOffset;
+        std::string passFile = ctx.workDir + "/passfile" + std::to_string(i) + ".dat";
+        threads.push_back(std::thread(encodeChunk, part, std::cref(rs), std::cref(ctx), twoRuns, passFile, i,
+                                      sr.timeBudget > 0 || cancel ? &budget : nullptr, std::ref(results.at(i))));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+        threads.at(i).join();
+
+    sr.usageP1 = processUsage();
+    sr.usageP2 = processUsage();
+    sr.realTime = 0;
+    sr.firstPassCached = twoRuns;
+    sr.tooSlow = false;
+    for (size_t i = 0; i < count; i++)
+        sr.tooSlow = sr.tooSlow || results.at(i).stopped;
+    ivfJoiner joiner;
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        const chunkResult &r = results.at(i);
+        // Chunks of a stopped trial are cut short and not worth scoring
+        if (!r.ok || (!sr.tooSlow && !joiner.append(r.output))) {
+            std::cout << "Chunk " << i << " starting at frame " << rs.chunkStarts.at(i) << " failed to encode" << std::endl;
+            ok = false;
+        }
+        sr.usageP1.add(r.usageP1);
+        sr.usageP2.add(r.usageP2);
+        sr.realTime = std::max(sr.realTime, r.realTime);
+        sr.firstPassCached = sr.firstPassCached && r.firstPassCached;
+    }
+    sr.cpuTimeP1 = sr.usageP1.cpuTime();
+    sr.cpuTimeP2 = sr.usageP2.cpuTime();
+    sr.netCpuTime = sr.cpuTimeP1 + sr.cpuTimeP2;
+    joined = joiner.data();
+    return ok;
+}
@@ -0,0 +1,38 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <stdint.h>
+#include <vector>
+
+namespace runner
+{
+    // First frames of about count chunks of frames. Every boundary moves to a scene cut within a quarter
+    // of a chunk if there is one, and no chunk is shorter than minLength frames.
+    std::vector<long> chunkStarts(const std::vector<long> &sceneCuts, long frames, int count, long minLength);
+
+    // Encodes sr as one encoder process per chunk in rs.chunkStarts, all running at once the way a chunked
+    // encoding pipeline would, and joins the chunks into one ivf stream. Cpu time and resource usage are
+    // summed over the chunks and real time is the wall time of the slowest one.
+    // With a timeBudget, every chunk is stopped once the chunks together are over it. Setting cancel stops them all.
+    // Returns false if any chunk fails to encode.
+    bool encodeChunks(singleRun &sr, const runSettings &rs, const trialContext &ctx, bool twoRuns, std::vector<uint8_t> &joined,
+                      const std::atomic<bool> *cancel = nullptr);
+};
@@ -0,0 +1,50 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "framestore.h"
+#include <vector>
+
+namespace runner
+{
+    // Complexity of the source luma, measured on the prepared reference.
+    // si and ti follow ITU-T P.910 (standard deviation of the Sobel magnitude and of the frame difference)
+    // but are averaged over the sampled frames rather than maxed, so one scene cut does not dominate.
+    // noise is Immerkaer's fast estimate of the noise standard deviation. All are in 8 bit sample units.
+    struct contentFeatures {
+        bool valid = false;
+        double si = 0;
+        double ti = 0;
+        double noise = 0;
+        long sceneCuts = 0;
+        long framesAnalyzed = 0;
+    };
+
+    // Looks at up to maxPairs pairs of consecutive frames for si, ti and noise and at every frame for scene cuts
+    contentFeatures analyzeContent(const frameStore &store, long maxPairs = 60);
+
+    // Mean absolute luma difference of every frame from the one before, on every eighth row. Frame 0 is 0.
+    std::vector<double> frameActivity(const frameStore &store);
+    // Frames that start a new scene, where the difference jumps well above the recent average
+    std::vector<long> sceneCutFrames(const std::vector<double> &activity);
+
+    // First bitrate guess in kbps for a vmaf target, from a log linear model of bits per pixel
+    double predictBitrate(const contentFeatures &content, const runSettings &rs, double vmafTarget);
+};
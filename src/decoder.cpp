@@ -0,0 +1,237 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decoder.h"
+#include <stdio.h>
+#include <string.h>
+
+int runner::openDecoder(int *stream_idx, AVCodecContext **dec_ctx, AVFormatContext *fmt_ctx, enum AVMediaType type)
+{
+    int ret, stream_index;
+    AVStream *st;
+    AVCodec *dec = NULL;
+    AVDictionary *opts = NULL;
+
+    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not find %s stream in input file\n",
+                av_get_media_type_string(type));
+        return ret;
+    } else {
+        stream_index = ret;
+        st = fmt_ctx->streams[stream_index];
+
+        /* find decoder for the stream */
+        dec = avcodec_find_decoder(st->codecpar->codec_id);
+        if (!dec) {
+            fprintf(stderr, "Failed to find %s codec\n",
+                    av_get_media_type_string(type));
+            return AVERROR(EINVAL);
+        }
+
+        /* Allocate a codec context for the decoder */
+        *dec_ctx = avcodec_alloc_context3(dec);
+        if (!*dec_ctx) {
+            fprintf(stderr, "Failed to allocate the %s codec context\n",
+                    av_get_media_type_string(type));
+            return AVERROR(ENOMEM);
+        }
+
+        /* Copy codec parameters from input stream to output codec context */
+        if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0) {
+            fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n",
+                    av_get_media_type_string(type));
+            return ret;
+        }
+
+        /* Init the decoders, with or without reference counting */
+        av_dict_set(&opts, "refcounted_frames", "0", 0);
+        if ((ret = avcodec_open2(*dec_ctx, dec, &opts)) < 0) {
+            fprintf(stderr, "Failed to open %s codec\n",
+                    av_get_media_type_string(type));
+            return ret;
+        }
+        *stream_idx = stream_index;
+    }
+    return 0;
+}
+int runner::decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt, const std::function<void(AVFrame *)> &onFrame)
+{
+    int ret = avcodec_send_packet(dec_ctx, pkt);
+    if (ret < 0) {
+        fprintf(stderr, "Error sending a packet for decoding\n");
+        return ret;
+    }
+
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        else if (ret < 0) {
+            fprintf(stderr, "Error during decoding\n");
+            return ret;
+        }
+        onFrame(frame);
+    }
+    return 0;
+}
+
+long runner::decodeFile(const std::string &filename, const std::function<void(AVFrame *)> &onFrame)
+{
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *context = NULL;
+    int idx = -1;
+
+    if (avformat_open_input(&fmt_ctx, filename.c_str(), NULL, NULL) < 0) {
+        fprintf(stderr, "Could not open %s\n", filename.c_str());
+        return -1;
+    }
+    if (avformat_find_stream_info(fmt_ctx, NULL) < 0 || openDecoder(&idx, &context, fmt_ctx, AVMEDIA_TYPE_VIDEO) < 0) {
+        avcodec_free_context(&context);
+        avformat_close_input(&fmt_ctx);
+        return -1;
+    }
+
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    long frames = 0;
+    auto counted = [&] (AVFrame *f) {
+        frames++;
+        onFrame(f);
+    };
+
+    int ret = 0;
+    while (ret >= 0 && av_read_frame(fmt_ctx, pkt) >= 0) {
+        if (pkt->stream_index == idx)
+            ret = decode(context, frame, pkt, counted);
+        av_packet_unref(pkt);
+    }
+    /* flush the decoder */
+    if (ret >= 0)
+        ret = decode(context, frame, NULL, counted);
+
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&context);
+    avformat_close_input(&fmt_ctx);
+
+    if (ret < 0)
+        return ret;
+    return frames;
+}
+
+runner::streamDecoder::streamDecoder(enum AVCodecID codec)
+{
+    const AVCodec *dec = NULL;
+    // Prefer the software AV1 decoders, ffmpeg's native one only works with hardware acceleration
+    if (codec == AV_CODEC_ID_AV1) {
+        dec = avcodec_find_decoder_by_name("libdav1d");
+        if (!dec)
+            dec = avcodec_find_decoder_by_name("libaom-av1");
+    }
+    if (!dec)
+        dec = avcodec_find_decoder(codec);
+    if (!dec) {
+        fprintf(stderr, "Failed to find a decoder for the encoder output\n");
+        return;
+    }
+
+    context = avcodec_alloc_context3(dec);
+    if (!context || avcodec_open2(context, dec, NULL) < 0) {
+        fprintf(stderr, "Failed to open decoder %s\n", dec->name);
+        avcodec_free_context(&context);
+        context = nullptr;
+        return;
+    }
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+}
+
+runner::streamDecoder::~streamDecoder()
+{
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    avcodec_free_context(&context);
+}
+
+int runner::streamDecoder::decode(const uint8_t *data, size_t size, int64_t pts, const std::function<void(AVFrame *)> &onFrame)
+{
+    if (!good())
+        return AVERROR(EINVAL);
+    if (av_new_packet(pkt, (int) size) < 0)
+        return AVERROR(ENOMEM);
+    memcpy(pkt->data, data, size);
+    pkt->pts = pts;
+    int ret = runner::decode(context, frame, pkt, onFrame);
+    av_packet_unref(pkt);
+    return ret;
+}
+
+int runner::streamDecoder::flush(const std::function<void(AVFrame *)> &onFrame)
+{
+    if (!good())
+        return AVERROR(EINVAL);
+    return runner::decode(context, frame, NULL, onFrame);
+}
+
+runner::elementaryReader::elementaryReader(enum AVCodecID codec)
+{
+    parser = av_parser_init(codec);
+    if (parser)
+        context = avcodec_alloc_context3(NULL);
+}
+
+runner::elementaryReader::~elementaryReader()
+{
+    if (parser)
+        av_parser_close(parser);
+    avcodec_free_context(&context);
+}
+
+bool runner::elementaryReader::parse(const uint8_t *data, size_t size, const packetCallback &onPacket)
+{
+    if (!parser || !context)
+        return false;
+    // A zero size call is the end of the stream
+    do {
+        uint8_t *out = nullptr;
+        int outSize = 0;
+        int used = av_parser_parse2(parser, context, &out, &outSize, data, (int) size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+        if (used < 0)
+            return false;
+        data += used;
+        size -= used;
+        if (outSize > 0) {
+            onPacket(out, outSize, frameCount);
+            frameCount++;
+        } else if (used == 0) {
+            break;
+        }
+    } while (size > 0);
+    return true;
+}
+
+bool runner::elementaryReader::feed(const uint8_t *data, size_t size, const packetCallback &onPacket)
+{
+    return size == 0 || parse(data, size, onPacket);
+}
+
+void runner::elementaryReader::flush(const packetCallback &onPacket)
+{
+    parse(nullptr, 0, onPacket);
+}
@@ -0,0 +1,65 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+
+namespace runner
+{
+    // Decodes a bare stream of packets, such as the frames of an IVF file, without a demuxer.
+    class streamDecoder {
+    public:
+        streamDecoder(enum AVCodecID codec);
+        ~streamDecoder();
+
+        bool good() const { return context != nullptr; }
+
+        int decode(const uint8_t *data, size_t size, int64_t pts, const std::function<void(AVFrame *)> &onFrame);
+        int flush(const std::function<void(AVFrame *)> &onFrame);
+
+    private:
+        AVCodecContext *context = nullptr;
+        AVPacket *pkt = nullptr;
+        AVFrame *frame = nullptr;
+    };
+
+    // Splits a bare elementary stream, such as the annex B output of x264 and x265, into packets with libavcodec's
+    // parser, the way ivfReader splits IVF. The stream has no timestamps, so packets are numbered as they come.
+    class elementaryReader {
+    public:
+        typedef std::function<void(const uint8_t *data, size_t size, int64_t pts)> packetCallback;
+
+        elementaryReader(enum AVCodecID codec);
+        ~elementaryReader();
+
+        // Returns false if there is no parser for the codec
+        bool feed(const uint8_t *data, size_t size, const packetCallback &onPacket);
+        // The parser holds on to the last packet until it knows the stream has ended
+        void flush(const packetCallback &onPacket);
+
+        long frames() const { return frameCount; }
+
+    private:
+        bool parse(const uint8_t *data, size_t size, const packetCallback &onPacket);
+
+        AVCodecParserContext *parser = nullptr;
+        AVCodecContext *context = nullptr;
+        long frameCount = 0;
+    };
+};
@@ -0,0 +1,373 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encoders.h"
+#include "framestore.h"
+#include "scaling.h"
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+namespace {
+    // One every 10 seconds
+    int keyframeDistance(const runner::runSettings &rs)
+    {
+        return (int) (rs.videoFrames / rs.videoLength * 10.0);
+    }
+
+    // The first line of the output of cmd, stderr included, that contains marker, or fallback
+    std::string versionLine(const std::string &cmd, const std::string &marker, const std::string &fallback)
+    {
+        std::string help = runner::commandOutput(cmd);
+        size_t at = help.find(marker);
+        if (at == std::string::npos)
+            return fallback;
+        size_t begin = help.rfind('\n', at);
+        size_t end = help.find('\n', at);
+        std::string line = help.substr(begin == std::string::npos ? 0 : begin + 1, end == std::string::npos ? std::string::npos : end - begin - 1);
+        line.erase(0, line.find_first_not_of(" \t"));
+        return line;
+    }
+
+    std::string selfPath()
+    {
+        char path[4096];
+        ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        if (n <= 0)
+            return "scv";
+        path[n] = 0;
+        return path;
+    }
+
+    const runner::aomencBackend aomenc;
+    const runner::svtAv1Backend svtAv1;
+    const runner::rav1eBackend rav1e;
+    const runner::x264Backend x264;
+    const runner::x265Backend x265;
+    const runner::fakeBackend fake;
+    const runner::encoderBackend *const backends[] = { &aomenc, &svtAv1, &rav1e, &x264, &x265, &fake };
+}
+
+std::string runner::aomencBackend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "aomenc";
+
+    cmd += " --bit-depth=" + std::to_string(rs.bits) + " --width=" + std::to_string(rs.xRes) + " --height=" + std::to_string(rs.yRes) + " --fps=" + std::to_string(rs.videoFPSNum) + "/" + std::to_string(rs.videoFPSDenom);
+
+    if (runNumber != 0)
+        cmd += " --fpf='" + passFile + "'" + " --passes=2 --pass=" + std::to_string(runNumber);
+    else
+        cmd += " --passes=1 --pass=1";
+    cmd += " --input-bit-depth=" + std::to_string(rs.videoDepth);
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --end-usage=cq --cq-level=" + std::to_string((int) sr.qFactor);
+    else
+        cmd += " --end-usage=vbr --bias-pct=100 --target-bitrate=" + std::to_string((int) sr.bitrate);
+    if (rs.useQFactor && sr.qFactor == 0)
+        cmd += " --lossless=1";
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --skip=" + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " --limit=" + std::to_string(sr.frameLimit);
+    cmd += " --kf-max-dist=" + std::to_string(keyframeDistance(rs));
+
+    cmd += " --ivf --output=" + output + " '" + rs.referenceFile + "'";
+    return cmd;
+}
+
+std::string runner::aomencBackend::threadArguments(int threads, const runSettings &rs) const
+{
+    int log2Cols, log2Rows;
+    tileLayout(threads, rs.xRes, rs.yRes, log2Cols, log2Rows);
+    return " --threads=" + std::to_string(threads) + " --row-mt=1 --tile-columns=" + std::to_string(log2Cols) + " --tile-rows=" + std::to_string(log2Rows);
+}
+
+std::string runner::aomencBackend::version() const
+{
+    return versionLine("aomenc --help", "AV1 Encoder", name());
+}
+
+std::string runner::svtAv1Backend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "SvtAv1EncApp -i '" + rs.referenceFile + "'";
+    cmd += " -w " + std::to_string(rs.xRes) + " -h " + std::to_string(rs.yRes) + " --input-depth " + std::to_string(rs.videoDepth)
+         + " --fps-num " + std::to_string(rs.videoFPSNum) + " --fps-denom " + std::to_string(rs.videoFPSDenom);
+    if (runNumber != 0)
+        cmd += " --pass " + std::to_string(runNumber) + " --stats '" + passFile + "'";
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --rc 0 --crf " + std::to_string((int) sr.qFactor);
+    else
+        cmd += " --rc 1 --tbr " + std::to_string((int) sr.bitrate);
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --skip " + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " -n " + std::to_string(sr.frameLimit);
+    cmd += " --keyint " + std::to_string(keyframeDistance(rs));
+
+    cmd += " -b " + (output == "-" ? std::string("stdout") : output);
+    return cmd;
+}
+
+std::string runner::svtAv1Backend::threadArguments(int threads, const runSettings &rs) const
+{
+    int log2Cols, log2Rows;
+    tileLayout(threads, rs.xRes, rs.yRes, log2Cols, log2Rows);
+    return " --lp " + std::to_string(threads) + " --tile-columns " + std::to_string(log2Cols) + " --tile-rows " + std::to_string(log2Rows);
+}
+
+std::string runner::svtAv1Backend::version() const
+{
+    return versionLine("SvtAv1EncApp --version", "SVT-AV1", name());
+}
+
+std::string runner::rav1eBackend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "rav1e '" + y4mPath(rs.referenceFile) + "' -y";
+    if (runNumber == 1)
+        cmd += " --first-pass '" + passFile + "'";
+    else if (runNumber == 2)
+        cmd += " --second-pass '" + passFile + "'";
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --quantizer " + std::to_string((int) sr.qFactor);
+    else
+        cmd += " --bitrate " + std::to_string((int) sr.bitrate);
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --skip " + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " --limit " + std::to_string(sr.frameLimit);
+    cmd += " --keyint " + std::to_string(keyframeDistance(rs));
+
+    cmd += " -o " + output;
+    return cmd;
+}
+
+std::string runner::rav1eBackend::threadArguments(int threads, const runSettings &rs) const
+{
+    int log2Cols, log2Rows;
+    tileLayout(threads, rs.xRes, rs.yRes, log2Cols, log2Rows);
+    return " --threads " + std::to_string(threads) + " --tiles " + std::to_string(1 << (log2Cols + log2Rows));
+}
+
+std::string runner::rav1eBackend::version() const
+{
+    return versionLine("rav1e --version", "rav1e", name());
+}
+
+std::string runner::x264Backend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "x264 --demuxer raw --input-csp i420 --input-res " + std::to_string(rs.xRes) + "x" + std::to_string(rs.yRes)
+                    + " --fps " + std::to_string(rs.videoFPSNum) + "/" + std::to_string(rs.videoFPSDenom);
+    // Older builds only know the depth options when they were built for high bit depth
+    if (rs.bits > 8)
+        cmd += " --input-depth " + std::to_string(rs.videoDepth) + " --output-depth " + std::to_string(rs.bits);
+    if (runNumber != 0)
+        cmd += " --pass " + std::to_string(runNumber) + " --stats '" + passFile + "'";
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --crf " + std::to_string((int) sr.qFactor);
+    else
+        cmd += " --bitrate " + std::to_string((int) sr.bitrate);
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --seek " + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " --frames " + std::to_string(sr.frameLimit);
+    cmd += " --keyint " + std::to_string(keyframeDistance(rs));
+
+    cmd += " --muxer raw -o " + output + " '" + rs.referenceFile + "'";
+    return cmd;
+}
+
+std::string runner::x264Backend::threadArguments(int threads, const runSettings &rs) const
+{
+    return " --threads " + std::to_string(threads);
+}
+
+std::string runner::x264Backend::version() const
+{
+    return versionLine("x264 --version", "x264", name());
+}
+
+std::string runner::x265Backend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "x265 --input '" + rs.referenceFile + "' --input-csp i420 --input-res " + std::to_string(rs.xRes) + "x" + std::to_string(rs.yRes)
+                    + " --fps " + std::to_string(rs.videoFPSNum) + "/" + std::to_string(rs.videoFPSDenom);
+    if (rs.bits > 8)
+        cmd += " --input-depth " + std::to_string(rs.videoDepth) + " --output-depth " + std::to_string(rs.bits);
+    if (runNumber != 0)
+        cmd += " --pass " + std::to_string(runNumber) + " --stats '" + passFile + "'";
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --crf " + std::to_string((int) sr.qFactor);
+    else
+        cmd += " --bitrate " + std::to_string((int) sr.bitrate);
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --seek " + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " --frames " + std::to_string(sr.frameLimit);
+    cmd += " --keyint " + std::to_string(keyframeDistance(rs));
+
+    cmd += " --output " + output;
+    return cmd;
+}
+
+std::string runner::x265Backend::threadArguments(int threads, const runSettings &rs) const
+{
+    return " --pools " + std::to_string(threads);
+}
+
+std::string runner::x265Backend::version() const
+{
+    // x265 prints its version to stderr
+    return versionLine("x265 --version", "HEVC encoder version", name());
+}
+
+std::string runner::fakeBackend::command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const
+{
+    std::string cmd = "'" + selfPath() + "' --fake-encoder --input='" + rs.referenceFile + "'";
+    cmd += " --width=" + std::to_string(rs.xRes) + " --height=" + std::to_string(rs.yRes) + " --fps=" + std::to_string(rs.videoFPSNum) + "/" + std::to_string(rs.videoFPSDenom);
+
+    cmd += parameters().arguments(sr.params);
+
+    if (rs.useQFactor)
+        cmd += " --qscale=" + std::to_string(std::max(1, (int) sr.qFactor));
+    else
+        cmd += " --bitrate=" + std::to_string((int) sr.bitrate);
+
+    if (sr.threads > 0)
+        cmd += threadArguments(sr.threads, rs);
+    if (sr.frameOffset > 0)
+        cmd += " --skip=" + std::to_string(sr.frameOffset);
+    if (sr.frameLimit > 0)
+        cmd += " --limit=" + std::to_string(sr.frameLimit);
+    cmd += " --keyint=" + std::to_string(keyframeDistance(rs));
+
+    cmd += " --output=" + output;
+    return cmd;
+}
+
+std::string runner::fakeBackend::threadArguments(int threads, const runSettings &rs) const
+{
+    return " --threads=" + std::to_string(threads);
+}
+
+std::string runner::fakeBackend::version() const
+{
+    return "fake mpeg4 (libavcodec " + std::to_string(avcodec_version()) + ")";
+}
+
+const runner::encoderBackend *runner::findEncoder(const std::string &name)
+{
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (name == backends[i]->name())
+            return backends[i];
+    }
+    return nullptr;
+}
+
+std::string runner::encoderNames()
+{
+    std::string names;
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (i > 0)
+            names += ", ";
+        names += backends[i]->name();
+    }
+    return names;
+}
+
+const runner::encoderBackend &runner::encoderFor(const runSettings &rs)
+{
+    const encoderBackend *encoder = findEncoder(rs.encodingProgram);
+    if (!encoder) {
+        std::cout << "Unknown encoder " << rs.encodingProgram << ", use one of: " << encoderNames() << std::endl;
+        exit(1);
+    }
+    return *encoder;
+}
+
+std::string runner::y4mPath(const std::string &referenceFile)
+{
+    return referenceFile + ".y4m";
+}
+
+bool runner::prepareEncoderInput(const runSettings &rs)
+{
+    if (!encoderFor(rs).y4mInput())
+        return true;
+    // Concurrent trials wait for the first one to finish writing the copy
+    static std::mutex lock;
+    static std::set<std::string> written;
+    std::lock_guard<std::mutex> hold(lock);
+    std::string path = y4mPath(rs.referenceFile);
+    if (written.count(path))
+        return true;
+
+    std::ifstream in(rs.referenceFile, std::ios::binary);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!in || !out)
+        return false;
+    out << "YUV4MPEG2 W" << rs.xRes << " H" << rs.yRes << " F" << rs.videoFPSNum << ":" << rs.videoFPSDenom << " Ip A1:1";
+    if (rs.bits > 8)
+        out << " C420p" << rs.bits << " XYSCSS=420P" << rs.bits;
+    else
+        out << " C420jpeg XYSCSS=420JPEG";
+    out << "\n";
+    std::vector<char> frame(frameStore::frameSizeFor(rs.xRes, rs.yRes, rs.bits));
+    while (in.read(frame.data(), frame.size())) {
+        out << "FRAME\n";
+        out.write(frame.data(), frame.size());
+    }
+    out.close();
+    if (!out) {
+        remove(path.c_str());
+        return false;
+    }
+    written.insert(path);
+    return true;
+}
@@ -0,0 +1,158 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // How packets are found in the encoder's output
+    enum class encoderContainer { ivf, elementary };
+
+    // One encoder scv can search: its command line, the settings it trades speed for size with, its rate control
+    // and threading flags and what comes out of it. Backends are stateless and picked by rs.encodingProgram.
+    class encoderBackend {
+    public:
+        virtual ~encoderBackend() {}
+
+        // The name -e takes, also the program that is run
+        virtual const char *name() const = 0;
+        virtual const parameterSpace &parameters() const = 0;
+        // Dimensions the speed pass sweeps before any asked for with -D, -k or -K
+        virtual std::vector<std::string> defaultSearch() const { return {"Speed"}; }
+        // Settings the scaling benchmark runs at. The defaults of every space are a two pass speed from the middle of its ladder.
+        virtual paramPoint scalingPoint() const { return parameters().defaults(); }
+
+        virtual enum AVCodecID codec() const = 0;
+        virtual encoderContainer container() const { return encoderContainer::ivf; }
+        // Reads the reference as y4m rather than raw video, see prepareEncoderInput
+        virtual bool y4mInput() const { return false; }
+        virtual bool twoPass() const { return true; }
+        virtual int maxBits() const = 0;
+        // The quantizer -Q searches runs from 0, the best quality, to maxQuality
+        virtual int maxQuality() const = 0;
+        virtual int defaultQuality() const = 0;
+
+        // The command line for a trial. runNumber is 0 for single pass, otherwise the pass of a two pass encode.
+        // An output of - writes to stdout.
+        virtual std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const = 0;
+        // Flags that spread one encode over this many threads
+        virtual std::string threadArguments(int threads, const runSettings &rs) const = 0;
+        // Version line for telling sessions of different builds apart, or just the name if there is none
+        virtual std::string version() const = 0;
+    };
+
+    class aomencBackend : public encoderBackend {
+    public:
+        const char *name() const { return "aomenc"; }
+        const parameterSpace &parameters() const { return aomencParameters(); }
+        std::vector<std::string> defaultSearch() const { return {"Speed", "RTDeadline"}; }
+        enum AVCodecID codec() const { return AV_CODEC_ID_AV1; }
+        int maxBits() const { return 12; }
+        int maxQuality() const { return 63; }
+        int defaultQuality() const { return 30; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    class svtAv1Backend : public encoderBackend {
+    public:
+        const char *name() const { return "SvtAv1EncApp"; }
+        const parameterSpace &parameters() const { return svtAv1Parameters(); }
+        enum AVCodecID codec() const { return AV_CODEC_ID_AV1; }
+        int maxBits() const { return 10; }
+        int maxQuality() const { return 63; }
+        int defaultQuality() const { return 35; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    class rav1eBackend : public encoderBackend {
+    public:
+        const char *name() const { return "rav1e"; }
+        const parameterSpace &parameters() const { return rav1eParameters(); }
+        enum AVCodecID codec() const { return AV_CODEC_ID_AV1; }
+        bool y4mInput() const { return true; }
+        int maxBits() const { return 12; }
+        int maxQuality() const { return 255; }
+        int defaultQuality() const { return 100; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    class x264Backend : public encoderBackend {
+    public:
+        const char *name() const { return "x264"; }
+        const parameterSpace &parameters() const { return x264Parameters(); }
+        enum AVCodecID codec() const { return AV_CODEC_ID_H264; }
+        encoderContainer container() const { return encoderContainer::elementary; }
+        int maxBits() const { return 10; }
+        int maxQuality() const { return 51; }
+        int defaultQuality() const { return 23; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    class x265Backend : public encoderBackend {
+    public:
+        const char *name() const { return "x265"; }
+        const parameterSpace &parameters() const { return x265Parameters(); }
+        enum AVCodecID codec() const { return AV_CODEC_ID_HEVC; }
+        encoderContainer container() const { return encoderContainer::elementary; }
+        int maxBits() const { return 12; }
+        int maxQuality() const { return 51; }
+        int defaultQuality() const { return 28; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    // scv's own stand-in encoder, see fakeencoder.h. Single pass mpeg4, quick enough to try a whole search in seconds.
+    class fakeBackend : public encoderBackend {
+    public:
+        const char *name() const { return "fake"; }
+        const parameterSpace &parameters() const { return fakeEncoderParameters(); }
+        enum AVCodecID codec() const { return AV_CODEC_ID_MPEG4; }
+        bool twoPass() const { return false; }
+        int maxBits() const { return 8; }
+        int maxQuality() const { return 31; }
+        int defaultQuality() const { return 6; }
+        std::string command(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber) const;
+        std::string threadArguments(int threads, const runSettings &rs) const;
+        std::string version() const;
+    };
+
+    // Returns nullptr for an unknown name
+    const encoderBackend *findEncoder(const std::string &name);
+    // Every backend name, for messages
+    std::string encoderNames();
+    // The backend rs.encodingProgram names. doSimulations checks that it exists before anything else asks.
+    const encoderBackend &encoderFor(const runSettings &rs);
+
+    // Where the y4m copy of a raw reference goes
+    std::string y4mPath(const std::string &referenceFile);
+    // Writes the y4m copy of rs.referenceFile once per session if the backend reads y4m. Returns false if that failed.
+    bool prepareEncoderInput(const runSettings &rs);
+};
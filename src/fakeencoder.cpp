@@ -0,0 +1,212 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fakeencoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/frame.h>
+}
+
+namespace {
+    void putLE16(std::vector<uint8_t> &out, uint16_t v)
+    {
+        out.push_back((uint8_t) v);
+        out.push_back((uint8_t) (v >> 8));
+    }
+
+    void putLE32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        putLE16(out, (uint16_t) v);
+        putLE16(out, (uint16_t) (v >> 16));
+    }
+
+    void putLE64(std::vector<uint8_t> &out, uint64_t v)
+    {
+        putLE32(out, (uint32_t) v);
+        putLE32(out, (uint32_t) (v >> 32));
+    }
+
+    long getLong(const std::map<std::string, std::string> &args, const std::string &name, long def)
+    {
+        auto it = args.find(name);
+        return it == args.end() ? def : atol(it->second.c_str());
+    }
+
+    // Writes every packet the encoder has ready as an IVF frame
+    bool drain(AVCodecContext *context, AVPacket *pkt, FILE *out)
+    {
+        int ret;
+        while ((ret = avcodec_receive_packet(context, pkt)) >= 0) {
+            std::vector<uint8_t> header;
+            putLE32(header, (uint32_t) pkt->size);
+            putLE64(header, (uint64_t) pkt->pts);
+            bool written = fwrite(header.data(), 1, header.size(), out) == header.size() &&
+                           fwrite(pkt->data, 1, pkt->size, out) == (size_t) pkt->size;
+            av_packet_unref(pkt);
+            if (!written)
+                return false;
+        }
+        return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF;
+    }
+}
+
+int runner::runFakeEncoder(int argc, char **argv)
+{
+    std::map<std::string, std::string> args;
+    for (int i = 2; i < argc; i++) {
+        std::string a = argv[i];
+        size_t eq = a.find('=');
+        if (a.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            std::cerr << "fake encoder: unknown argument " << a << std::endl;
+            return 1;
+        }
+        args[a.substr(2, eq - 2)] = a.substr(eq + 1);
+    }
+
+    int width = (int) getLong(args, "width", 0);
+    int height = (int) getLong(args, "height", 0);
+    int fpsNum = 25, fpsDenom = 1;
+    if (args.count("fps"))
+        sscanf(args["fps"].c_str(), "%d/%d", &fpsNum, &fpsDenom);
+    long skip = getLong(args, "skip", 0);
+    long limit = getLong(args, "limit", 0);
+    long speed = getLong(args, "speed", 1);
+    if (width <= 0 || height <= 0 || fpsNum <= 0 || fpsDenom <= 0 || !args.count("input")) {
+        std::cerr << "fake encoder: needs --input, --width, --height and --fps" << std::endl;
+        return 1;
+    }
+
+    FILE *in = fopen(args["input"].c_str(), "rb");
+    if (!in) {
+        std::cerr << "fake encoder: unable to open " << args["input"] << std::endl;
+        return 1;
+    }
+    size_t frameSize = (size_t) width * height + 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+    if (skip > 0 && fseeko(in, (off_t) (skip * frameSize), SEEK_SET) != 0) {
+        fclose(in);
+        return 1;
+    }
+    std::string output = args.count("output") ? args["output"] : "-";
+    FILE *out = output == "-" ? stdout : fopen(output.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return 1;
+    }
+
+    const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    AVCodecContext *context = codec ? avcodec_alloc_context3(codec) : nullptr;
+    if (!context) {
+        std::cerr << "fake encoder: libavcodec has no mpeg4 encoder" << std::endl;
+        fclose(in);
+        if (out != stdout)
+            fclose(out);
+        return 1;
+    }
+    context->width = width;
+    context->height = height;
+    context->pix_fmt = AV_PIX_FMT_YUV420P;
+    context->time_base.num = fpsDenom;
+    context->time_base.den = fpsNum;
+    context->framerate.num = fpsNum;
+    context->framerate.den = fpsDenom;
+    context->gop_size = (int) getLong(args, "keyint", 250);
+    context->thread_count = (int) getLong(args, "threads", 1);
+    int quality = 0;
+    if (args.count("qscale")) {
+        context->flags |= AV_CODEC_FLAG_QSCALE;
+        quality = FF_QP2LAMBDA * (int) std::max(1L, std::min(31L, getLong(args, "qscale", 4)));
+        context->global_quality = quality;
+    } else {
+        context->bit_rate = getLong(args, "bitrate", 1000) * 1000;
+    }
+
+    // Every step up in effort adds a costlier mode decision, the same way a real encoder's speed ladder does
+    AVDictionary *options = nullptr;
+    av_dict_set(&options, "mbd", speed >= 2 ? "rd" : (speed >= 1 ? "bits" : "simple"), 0);
+    if (speed >= 2)
+        av_dict_set(&options, "trellis", "1", 0);
+    if (speed >= 3) {
+        av_dict_set(&options, "cmp", "satd", 0);
+        av_dict_set(&options, "subcmp", "satd", 0);
+        av_dict_set(&options, "dia_size", "2", 0);
+    }
+    int opened = avcodec_open2(context, codec, &options);
+    av_dict_free(&options);
+
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *pkt = av_packet_alloc();
+    bool ok = opened >= 0 && frame && pkt;
+    if (ok) {
+        frame->width = width;
+        frame->height = height;
+        frame->format = AV_PIX_FMT_YUV420P;
+        ok = av_frame_get_buffer(frame, 0) >= 0;
+    }
+    if (ok) {
+        std::vector<uint8_t> header = {'D', 'K', 'I', 'F'};
+        putLE16(header, 0);
+        putLE16(header, 32);
+        header.insert(header.end(), {'F', 'M', 'P', '4'});
+        putLE16(header, (uint16_t) width);
+        putLE16(header, (uint16_t) height);
+        putLE32(header, (uint32_t) fpsNum);
+        putLE32(header, (uint32_t) fpsDenom);
+        // The frame count is unknown while streaming, readers do not rely on it
+        putLE32(header, 0);
+        putLE32(header, 0);
+        ok = fwrite(header.data(), 1, header.size(), out) == header.size();
+    }
+
+    std::vector<uint8_t> raw(frameSize);
+    for (long n = 0; ok && (limit <= 0 || n < limit) && fread(raw.data(), 1, frameSize, in) == frameSize; n++) {
+        ok = av_frame_make_writable(frame) >= 0;
+        const uint8_t *plane = raw.data();
+        for (int p = 0; ok && p < 3; p++) {
+            int w = p == 0 ? width : (width + 1) / 2;
+            int h = p == 0 ? height : (height + 1) / 2;
+            for (int y = 0; y < h; y++)
+                memcpy(frame->data[p] + (size_t) y * frame->linesize[p], plane + (size_t) y * w, w);
+            plane += (size_t) w * h;
+        }
+        frame->pts = n;
+        frame->quality = quality;
+        ok = ok && avcodec_send_frame(context, frame) >= 0 && drain(context, pkt, out);
+    }
+    if (ok)
+        ok = avcodec_send_frame(context, NULL) >= 0 && drain(context, pkt, out);
+
+    av_packet_free(&pkt);
+    av_frame_free(&frame);
+    avcodec_free_context(&context);
+    fclose(in);
+    if (out == stdout)
+        fflush(out);
+    else
+        fclose(out);
+    if (!ok)
+        std::cerr << "fake encoder: encoding failed" << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace runner
+{
+    // The stand-in encoder behind the "fake" backend, run as scv --fake-encoder --input=file --width=w ... It encodes
+    // raw 8 bit 4:2:0 video with libavcodec's mpeg4 encoder into IVF, so the whole search can be tried out and timed
+    // without an external encoder installed. --output=- writes to stdout. Returns the exit status.
+    int runFakeEncoder(int argc, char **argv);
+};
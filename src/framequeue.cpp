@@ -0,0 +1,64 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framequeue.h"
+
+runner::frameQueue::frameQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+runner::frameQueue::~frameQueue()
+{
+    for (size_t i = 0; i < frames.size(); i++) {
+        av_frame_free(&frames.at(i));
+    }
+}
+
+void runner::frameQueue::push(AVFrame *frame)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    notFull.wait(guard, [this] { return frames.size() < capacity || closed; });
+    if (closed) {
+        av_frame_free(&frame);
+        return;
+    }
+    frames.push_back(frame);
+    if (frames.size() > peak)
+        peak = frames.size();
+    notEmpty.notify_one();
+}
+
+AVFrame *runner::frameQueue::pop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    notEmpty.wait(guard, [this] { return !frames.empty() || closed; });
+    if (frames.empty())
+        return nullptr;
+    AVFrame *frame = frames.front();
+    frames.pop_front();
+    notFull.notify_one();
+    return frame;
+}
+
+void runner::frameQueue::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+}
@@ -0,0 +1,55 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace runner
+{
+    // Bounded queue of decoded frames between the decoder and the scorer.
+    // push blocks while the queue is full, which in turn stalls the encoder's output pipe,
+    // so at most capacity uncompressed frames exist at any time.
+    class frameQueue {
+    public:
+        frameQueue(size_t capacity);
+        ~frameQueue();
+
+        // Takes ownership of frame
+        void push(AVFrame *frame);
+
+        // Returns the next frame, which the caller must av_frame_free, or nullptr once the queue is closed and empty
+        AVFrame *pop();
+
+        void close();
+
+        size_t peakDepth() const { return peak; }
+
+    private:
+        std::deque<AVFrame *> frames;
+        std::mutex lock;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+        size_t capacity;
+        size_t peak = 0;
+        bool closed = false;
+    };
+};
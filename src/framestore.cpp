@@ -0,0 +1,166 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framestore.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+
+runner::frameStore::frameStore()
+{
+}
+
+runner::frameStore::~frameStore()
+{
+    unmap();
+    if (fd >= 0)
+        close(fd);
+}
+
+size_t runner::frameStore::frameSizeFor(int width, int height, int bits)
+{
+    int bytes = bits > 8 ? 2 : 1;
+    size_t chroma = (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+    return ((size_t) width * height + 2 * chroma) * bytes;
+}
+
+void runner::frameStore::setGeometry(int width, int height, int bits)
+{
+    w = width;
+    h = height;
+    depth = bits;
+    frameBytes = frameSizeFor(width, height, bits);
+}
+
+bool runner::frameStore::map(size_t bytes, bool writable)
+{
+    unmap();
+    if (bytes == 0)
+        return true;
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    void *p = mmap(NULL, bytes, prot, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        std::cout << "Unable to map " << filePath << std::endl;
+        return false;
+    }
+    data = (uint8_t *) p;
+    mappedBytes = bytes;
+#ifdef MADV_HUGEPAGE
+    if (huge)
+        madvise(data, mappedBytes, MADV_HUGEPAGE);
+#endif
+    if (!writable)
+        madvise(data, mappedBytes, MADV_SEQUENTIAL);
+    return true;
+}
+
+void runner::frameStore::unmap()
+{
+    if (data)
+        munmap(data, mappedBytes);
+    data = nullptr;
+    mappedBytes = 0;
+}
+
+bool runner::frameStore::create(const std::string &path, int width, int height, int bits, long expectedFrames, bool hugePages)
+{
+    filePath = path;
+    huge = hugePages;
+    setGeometry(width, height, bits);
+    frameCount = 0;
+    // Duration based frame counts are only estimates, leave some headroom before the first remap
+    capacity = expectedFrames + expectedFrames / 20 + 16;
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        std::cout << "Unable to create " << path << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, capacity * frameBytes) != 0) {
+        std::cout << "Unable to allocate " << capacity * frameBytes / 1024 / 1024 << "MB for " << path << std::endl;
+        return false;
+    }
+    return map(capacity * frameBytes, true);
+}
+
+bool runner::frameStore::open(const std::string &path, int width, int height, int bits, bool hugePages)
+{
+    filePath = path;
+    huge = hugePages;
+    setGeometry(width, height, bits);
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || frameBytes == 0)
+        return false;
+    frameCount = st.st_size / frameBytes;
+    capacity = frameCount;
+    return map(frameCount * frameBytes, false);
+}
+
+bool runner::frameStore::appendFrame(uint8_t *planes[4], int strides[4])
+{
+    if (frameCount >= capacity) {
+        capacity = capacity + capacity / 2 + 16;
+        if (ftruncate(fd, capacity * frameBytes) != 0 || !map(capacity * frameBytes, true)) {
+            std::cout << "Unable to grow " << filePath << std::endl;
+            return false;
+        }
+    }
+    uint8_t *f = data + frameCount * frameBytes;
+    int bytes = depth > 8 ? 2 : 1;
+    int chromaX = (w + 1) / 2;
+    int chromaY = (h + 1) / 2;
+    planes[0] = f;
+    planes[1] = f + (size_t) w * h * bytes;
+    planes[2] = planes[1] + (size_t) chromaX * chromaY * bytes;
+    planes[3] = NULL;
+    strides[0] = w * bytes;
+    strides[1] = chromaX * bytes;
+    strides[2] = chromaX * bytes;
+    strides[3] = 0;
+    frameCount++;
+    return true;
+}
+
+void runner::frameStore::finish()
+{
+    capacity = frameCount;
+    unmap();
+    if (ftruncate(fd, frameCount * frameBytes) != 0)
+        std::cout << "Unable to trim " << filePath << std::endl;
+    map(frameCount * frameBytes, false);
+}
+
+void runner::frameStore::planes(long index, const uint8_t *planes[3], int strides[3]) const
+{
+    const uint8_t *f = frame(index);
+    int bytes = depth > 8 ? 2 : 1;
+    int chromaX = (w + 1) / 2;
+    int chromaY = (h + 1) / 2;
+    planes[0] = f;
+    planes[1] = f + (size_t) w * h * bytes;
+    planes[2] = planes[1] + (size_t) chromaX * chromaY * bytes;
+    strides[0] = w * bytes;
+    strides[1] = chromaX * bytes;
+    strides[2] = chromaX * bytes;
+}
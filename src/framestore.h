@@ -0,0 +1,78 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace runner
+{
+    // Prepared reference video kept in a memory mapped, page aligned file of planar yuv420 frames.
+    // The file is plain raw video, so aomenc reads it by path while scorers read frames straight
+    // out of the mapping without copying. Samples wider than 8 bits are stored in 16 bit words.
+    class frameStore {
+    public:
+        frameStore();
+
+        static size_t frameSizeFor(int width, int height, int bits);
+        ~frameStore();
+
+        // Creates path with room for roughly expectedFrames frames; it grows as frames are appended.
+        // hugePages asks the kernel to back the mapping with transparent huge pages, which works for
+        // files on tmpfs such as /dev/shm.
+        bool create(const std::string &path, int width, int height, int bits, long expectedFrames, bool hugePages);
+
+        // Maps an existing store read only
+        bool open(const std::string &path, int width, int height, int bits, bool hugePages);
+
+        // Returns the planes of a new frame at the end of the store for the caller to fill in
+        bool appendFrame(uint8_t *planes[4], int strides[4]);
+
+        // Trims the file to the frames that were appended
+        void finish();
+
+        void planes(long index, const uint8_t *planes[3], int strides[3]) const;
+        const uint8_t *frame(long index) const { return data + index * frameBytes; }
+
+        long frames() const { return frameCount; }
+        size_t frameSize() const { return frameBytes; }
+        const std::string &path() const { return filePath; }
+        int width() const { return w; }
+        int height() const { return h; }
+        int bits() const { return depth; }
+
+    private:
+        bool map(size_t bytes, bool writable);
+        void unmap();
+        void setGeometry(int width, int height, int bits);
+
+        std::string filePath;
+        int fd = -1;
+        uint8_t *data = nullptr;
+        size_t mappedBytes = 0;
+        size_t frameBytes = 0;
+        long frameCount = 0;
+        long capacity = 0;
+        bool huge = false;
+        int w = 0;
+        int h = 0;
+        int depth = 8;
+    };
+};
@@ -0,0 +1,304 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frontier.h"
+#include "encoders.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+
+namespace {
+    const long frontierPassNumber = 4;
+    const int maxEncodesPerPoint = 8;
+}
+
+std::vector<runner::frontierPoint> runner::paretoFrontier(const std::vector<frontierPoint> &points, const runSettings &rs)
+{
+    std::vector<frontierPoint> sorted;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (points.at(i).converged)
+            sorted.push_back(points.at(i));
+    }
+    std::sort(sorted.begin(), sorted.end(), [&rs] (const frontierPoint &a, const frontierPoint &b) {
+        if (a.time(rs) != b.time(rs))
+            return a.time(rs) < b.time(rs);
+        return a.size < b.size;
+    });
+
+    // Sorted by time, a point is only worth having if it is smaller than everything faster
+    std::vector<frontierPoint> frontier;
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (frontier.empty() || sorted.at(i).size < frontier.back().size)
+            frontier.push_back(sorted.at(i));
+    }
+    return frontier;
+}
+
+runner::frontierExplorer::frontierExplorer(const runSettings &rs, const paramSweep &sweep, trialScheduler &scheduler, rateSearch &rateSearcher) :
+    rs(rs), scheduler(scheduler), rateSearcher(rateSearcher), encodeCount(0)
+{
+    paramPoint p = sweep.first();
+    points.push_back(p);
+    while (sweep.next(p, p))
+        points.push_back(p);
+}
+
+std::vector<runner::frontierPoint> runner::frontierExplorer::explore(double startRate, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv)
+{
+    long n = points.size();
+    std::map<long, frontierPoint> explored;
+
+    // Both ends and a coarse spread in between
+    std::vector<long> indices;
+    for (long k = 0; k <= 4; k++) {
+        long index = (n - 1) * k / 4;
+        if (std::find(indices.begin(), indices.end(), index) == indices.end())
+            indices.push_back(index);
+    }
+    if ((long) indices.size() > rs.frontierPoints)
+        indices.resize(std::max(1, rs.frontierPoints));
+    std::vector<double> startRates(indices.size(), startRate);
+
+    while (!indices.empty()) {
+        std::vector<frontierPoint> results = evaluate(indices, startRates, runsList, commandList, csv);
+        for (size_t i = 0; i < results.size(); i++)
+            explored[results.at(i).sweepIndex] = results.at(i);
+
+        std::vector<frontierPoint> all;
+        for (auto it = explored.begin(); it != explored.end(); it++)
+            all.push_back(it->second);
+        std::vector<frontierPoint> frontier = paretoFrontier(all, rs);
+
+        // Refine where neighbouring frontier points are furthest apart in log time times log size
+        std::vector<std::pair<double, long> > candidates;
+        for (size_t i = 0; i + 1 < frontier.size(); i++) {
+            const frontierPoint &a = frontier.at(i);
+            const frontierPoint &b = frontier.at(i + 1);
+            long lo = std::min(a.sweepIndex, b.sweepIndex);
+            long hi = std::max(a.sweepIndex, b.sweepIndex);
+            long middle = (lo + hi) / 2;
+            long best = -1;
+            for (long index = lo + 1; index < hi; index++) {
+                if (explored.count(index) == 0 && (best < 0 || std::abs(index - middle) < std::abs(best - middle)))
+                    best = index;
+            }
+            if (best < 0)
+                continue;
+            double gap = std::abs(std::log(b.time(rs) / a.time(rs))) * std::abs(std::log(a.size / b.size));
+            candidates.push_back(std::make_pair(gap, best));
+        }
+        // A single frontier point has nothing to pair with, look at its unexplored neighbours instead
+        if (frontier.size() == 1) {
+            for (long step = -1; step <= 1; step += 2) {
+                long index = frontier.front().sweepIndex + step;
+                while (index >= 0 && index < n && explored.count(index) > 0)
+                    index += step;
+                if (index >= 0 && index < n)
+                    candidates.push_back(std::make_pair(1.0, index));
+            }
+        }
+        std::sort(candidates.rbegin(), candidates.rend());
+
+        indices.clear();
+        startRates.clear();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            long index = candidates.at(i).second;
+            if ((long) (explored.size() + indices.size()) >= rs.frontierPoints || (int) indices.size() >= scheduler.slots())
+                break;
+            if (std::find(indices.begin(), indices.end(), index) != indices.end())
+                continue;
+            // Start from the rate of the closest explored point in the sweep
+            double rate = startRate;
+            long closest = -1;
+            for (auto it = explored.begin(); it != explored.end(); it++) {
+                if (closest < 0 || std::abs(it->first - index) < std::abs(closest - index)) {
+                    closest = it->first;
+                    rate = it->second.rate;
+                }
+            }
+            indices.push_back(index);
+            startRates.push_back(rate);
+        }
+    }
+
+    std::vector<frontierPoint> all;
+    for (auto it = explored.begin(); it != explored.end(); it++)
+        all.push_back(it->second);
+    std::cout << "Explored " << explored.size() << " of " << n << " parameter points" << std::endl;
+    return paretoFrontier(all, rs);
+}
+
+std::vector<runner::frontierPoint> runner::frontierExplorer::evaluate(const std::vector<long> &indices, const std::vector<double> &startRates,
+                                                                       std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv)
+{
+    // The rate searches are independent, so every round runs one probe of each unfinished search as a batch
+    std::vector<int> encodes(indices.size(), 0);
+    std::vector<double> lastRate(indices.size(), -1);
+    std::vector<bool> done(indices.size(), false);
+
+    while (true) {
+        std::vector<singleRun> batch;
+        std::vector<size_t> owners;
+        for (size_t i = 0; i < indices.size(); i++) {
+            if (done.at(i))
+                continue;
+            singleRun sr;
+            sr.params = points.at(indices.at(i));
+            sr.optimizationPassNumber = frontierPassNumber;
+            sr.scoreTarget = rs.vmafTarget;
+            sr.scoreEpsilon = rs.useQFactor ? 0 : rs.vmafEpsilon;
+            double rate;
+            if (!rs.useQFactor) {
+                sr.bitrate = rateSearcher.nextBitrate(runsList, rs.vmafTarget, frontierPassNumber, sr.params, startRates.at(i));
+                rate = sr.bitrate;
+            } else {
+                std::vector<singleRun> own;
+                for (size_t r = 0; r < runsList.size(); r++) {
+                    if (runsList.at(r).optimizationPassNumber == frontierPassNumber && runsList.at(r).params == sr.params)
+                        own.push_back(runsList.at(r));
+                }
+                int bestQ = 0;
+                int q = getNextTestQFactor(own, rs.vmafTarget, frontierPassNumber, bestQ, (int) startRates.at(i), encoderFor(rs).maxQuality());
+                if (q < 0) {
+                    done.at(i) = true;
+                    continue;
+                }
+                sr.qFactor = q;
+                rate = q;
+            }
+            // The search got stuck
+            if ((int) rate == (int) lastRate.at(i)) {
+                done.at(i) = true;
+                continue;
+            }
+            batch.push_back(sr);
+            owners.push_back(i);
+        }
+        if (batch.empty())
+            break;
+
+        std::vector<std::string> commands;
+        scheduler.run(batch, commands);
+        encodeCount += batch.size();
+        for (size_t b = 0; b < batch.size(); b++) {
+            singleRun &sr = batch.at(b);
+            size_t i = owners.at(b);
+            runsList.push_back(sr);
+            commandList.push_back(commands.at(b));
+            printResult(sr, rs, csv);
+
+            encodes.at(i)++;
+            lastRate.at(i) = rs.useQFactor ? sr.qFactor : sr.bitrate;
+            if (!rs.useQFactor && withinTarget(sr, rs.vmafTarget, rs.vmafEpsilon))
+                done.at(i) = true;
+            if (encodes.at(i) >= maxEncodesPerPoint)
+                done.at(i) = true;
+        }
+    }
+
+    std::vector<frontierPoint> results;
+    for (size_t i = 0; i < indices.size(); i++)
+        results.push_back(summarize(indices.at(i), runsList, commandList));
+    return results;
+}
+
+runner::frontierPoint runner::frontierExplorer::summarize(long index, const std::vector<singleRun> &runsList, const std::vector<std::string> &commandList) const
+{
+    frontierPoint fp;
+    fp.params = points.at(index);
+    fp.sweepIndex = index;
+
+    std::vector<size_t> own;
+    for (size_t r = 0; r < runsList.size(); r++) {
+        if (runsList.at(r).optimizationPassNumber == frontierPassNumber && runsList.at(r).params == fp.params)
+            own.push_back(r);
+    }
+    if (own.empty())
+        return fp;
+
+    auto take = [&] (size_t r) {
+        const singleRun &sr = runsList.at(r);
+        fp.rate = rs.useQFactor ? sr.qFactor : sr.bitrate;
+        fp.cpuTime = sr.netCpuTime;
+        fp.realTime = sr.realTime;
+        fp.size = sr.videoSize;
+        fp.vmaf = sr.vmaf;
+        fp.command = commandList.at(r);
+    };
+
+    if (rs.useQFactor) {
+        // The highest cq-level that still reaches the target
+        long best = -1;
+        for (size_t i = 0; i < own.size(); i++) {
+            const singleRun &sr = runsList.at(own.at(i));
+            if (sr.vmaf >= rs.vmafTarget && (best < 0 || sr.qFactor > runsList.at(best).qFactor))
+                best = own.at(i);
+        }
+        fp.converged = best >= 0;
+        take(best >= 0 ? best : own.back());
+        return fp;
+    }
+
+    long closest = -1, low = -1, high = -1;
+    for (size_t i = 0; i < own.size(); i++) {
+        long r = own.at(i);
+        double diff = runsList.at(r).vmaf - rs.vmafTarget;
+        if (closest < 0 || std::abs(diff) < std::abs(runsList.at(closest).vmaf - rs.vmafTarget))
+            closest = r;
+        if (diff <= 0 && (low < 0 || runsList.at(r).vmaf > runsList.at(low).vmaf))
+            low = r;
+        if (diff > 0 && (high < 0 || runsList.at(r).vmaf < runsList.at(high).vmaf))
+            high = r;
+    }
+    take(closest);
+    if (withinTarget(runsList.at(closest), rs.vmafTarget, rs.vmafEpsilon)) {
+        fp.converged = true;
+        return fp;
+    }
+
+    // Not within epsilon but bracketed: interpolate to the target, size and rate in log space
+    if (low >= 0 && high >= 0 && runsList.at(high).vmaf > runsList.at(low).vmaf && runsList.at(low).videoSize > 0) {
+        const singleRun &l = runsList.at(low);
+        const singleRun &h = runsList.at(high);
+        double t = (rs.vmafTarget - l.vmaf) / (h.vmaf - l.vmaf);
+        fp.rate = std::exp(std::log(l.bitrate) + t * (std::log(h.bitrate) - std::log(l.bitrate)));
+        fp.size = std::exp(std::log((double) l.videoSize) + t * (std::log((double) h.videoSize) - std::log((double) l.videoSize)));
+        fp.cpuTime = l.netCpuTime + t * (h.netCpuTime - l.netCpuTime);
+        fp.realTime = l.realTime + t * (h.realTime - l.realTime);
+        fp.vmaf = rs.vmafTarget;
+        singleRun interpolated = l;
+        interpolated.bitrate = fp.rate;
+        const encoderBackend &encoder = encoderFor(rs);
+        bool onePass = !encoder.twoPass() || encoder.parameters().onePass(fp.params) || !rs.useTwoPass;
+        fp.command = encoderCommand(interpolated, rs, "passfile.dat", "output.ivf", onePass ? 0 : 1);
+        fp.converged = true;
+    }
+    return fp;
+}
+
+void runner::printFrontier(const std::vector<frontierPoint> &frontier, const runSettings &rs, std::ostream &out)
+{
+    const parameterSpace &space = encoderFor(rs).parameters();
+    out << "CpuTime, RealTime, Size, " << (rs.useQFactor ? "Qfac" : "Bitrate") << ", vmaf, " << space.csvHeader() << ", Command" << std::endl;
+    for (size_t i = 0; i < frontier.size(); i++) {
+        const frontierPoint &fp = frontier.at(i);
+        out << fp.cpuTime << ", " << fp.realTime << ", " << (long) fp.size << ", " << fp.rate << ", " << fp.vmaf << ", "
+            << space.csvRow(fp.params) << ", \"" << fp.command << "\"" << std::endl;
+    }
+}
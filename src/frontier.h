@@ -0,0 +1,78 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "ratesearch.h"
+#include "scheduler.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Cost and size of one set of encoder parameters at the vmaf target
+    struct frontierPoint {
+        paramPoint params;
+        long sweepIndex = 0;
+        // Bitrate, or cq-level when q factor is used
+        double rate = 0;
+        double cpuTime = 0;
+        double realTime = 0;
+        double size = 0;
+        double vmaf = 0;
+        // False when the rate search ran out of encodes without reaching the target
+        bool converged = false;
+        std::string command;
+
+        // Cpu or real time, whichever rs says to optimize for
+        double time(const runSettings &rs) const { return rs.useCPUTime ? cpuTime : realTime; }
+    };
+
+    // Keeps the points that no other point beats on both time and size, sorted from fastest to slowest
+    std::vector<frontierPoint> paretoFrontier(const std::vector<frontierPoint> &points, const runSettings &rs);
+
+    // Explores the speed / size tradeoff at the vmaf target instead of settling on one operating point.
+    // Every explored point gets its own rate search. The ends and a coarse spread of the sweep are explored
+    // first, then the sweep points between the frontier neighbours that are furthest apart, until the gaps
+    // are closed or rs.frontierPoints points have been explored.
+    class frontierExplorer {
+    public:
+        frontierExplorer(const runSettings &rs, const paramSweep &sweep, trialScheduler &scheduler, rateSearch &rateSearcher);
+
+        // startRate is the first guess for every rate search, usually the result of pass 1.
+        // Every encode is appended to runsList and commandList and printed like any other trial.
+        std::vector<frontierPoint> explore(double startRate, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv);
+
+        long encodes() const { return encodeCount; }
+
+    private:
+        std::vector<frontierPoint> evaluate(const std::vector<long> &indices, const std::vector<double> &startRates,
+                                            std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv);
+        frontierPoint summarize(long index, const std::vector<singleRun> &runsList, const std::vector<std::string> &commandList) const;
+
+        const runSettings &rs;
+        trialScheduler &scheduler;
+        rateSearch &rateSearcher;
+        std::vector<paramPoint> points;
+        long encodeCount;
+    };
+
+    void printFrontier(const std::vector<frontierPoint> &frontier, const runSettings &rs, std::ostream &out);
+};
@@ -0,0 +1,163 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gp.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double lengthScales[] = {0.1, 0.2, 0.35, 0.6, 1.0, 2.0};
+    const double noiseLevels[] = {1e-4, 1e-2, 1e-1};
+}
+
+double runner::normalPdf(double z)
+{
+    return std::exp(-0.5 * z * z) / std::sqrt(2 * M_PI);
+}
+
+double runner::normalCdf(double z)
+{
+    return 0.5 * std::erfc(-z / std::sqrt(2.0));
+}
+
+double runner::gaussianProcess::kernel(const std::vector<double> &a, const std::vector<double> &b, double rs, double os) const
+{
+    double d = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double scale = (int) i < rateDims ? rs : os;
+        double diff = (a.at(i) - b.at(i)) / scale;
+        d += diff * diff;
+    }
+    return std::exp(-0.5 * d);
+}
+
+double runner::gaussianProcess::fitWith(double rs, double os, double nz)
+{
+    size_t n = inputs.size();
+    std::vector<std::vector<double> > l(n, std::vector<double>(n, 0));
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            double sum = kernel(inputs.at(i), inputs.at(j), rs, os);
+            if (i == j)
+                sum += nz;
+            for (size_t k = 0; k < j; k++)
+                sum -= l.at(i).at(k) * l.at(j).at(k);
+            if (i == j) {
+                if (sum <= 0)
+                    return -1e300;
+                l.at(i).at(i) = std::sqrt(sum);
+            } else {
+                l.at(i).at(j) = sum / l.at(j).at(j);
+            }
+        }
+    }
+
+    // Solve L L^T alpha = y
+    std::vector<double> z(n), a(n);
+    for (size_t i = 0; i < n; i++) {
+        double sum = targets.at(i);
+        for (size_t k = 0; k < i; k++)
+            sum -= l.at(i).at(k) * z.at(k);
+        z.at(i) = sum / l.at(i).at(i);
+    }
+    for (size_t i = n; i-- > 0;) {
+        double sum = z.at(i);
+        for (size_t k = i + 1; k < n; k++)
+            sum -= l.at(k).at(i) * a.at(k);
+        a.at(i) = sum / l.at(i).at(i);
+    }
+
+    double logLikelihood = 0;
+    for (size_t i = 0; i < n; i++)
+        logLikelihood += -0.5 * targets.at(i) * a.at(i) - std::log(l.at(i).at(i));
+
+    chol = l;
+    alpha = a;
+    rateScale = rs;
+    otherScale = os;
+    noise = nz;
+    return logLikelihood;
+}
+
+bool runner::gaussianProcess::fit(const std::vector<std::vector<double> > &x, const std::vector<double> &y, int leading)
+{
+    alpha.clear();
+    chol.clear();
+    if (x.empty() || x.size() != y.size())
+        return false;
+
+    inputs = x;
+    rateDims = leading;
+    yMean = 0;
+    for (size_t i = 0; i < y.size(); i++)
+        yMean += y.at(i);
+    yMean /= y.size();
+    double variance = 0;
+    for (size_t i = 0; i < y.size(); i++)
+        variance += (y.at(i) - yMean) * (y.at(i) - yMean);
+    yScale = y.size() > 1 ? std::sqrt(variance / (y.size() - 1)) : 1;
+    if (yScale <= 1e-12)
+        yScale = 1;
+    targets.clear();
+    for (size_t i = 0; i < y.size(); i++)
+        targets.push_back((y.at(i) - yMean) / yScale);
+
+    double best = -1e300, bestRate = 1, bestOther = 1, bestNoise = 1e-2;
+    for (double rs : lengthScales) {
+        for (double os : lengthScales) {
+            for (double nz : noiseLevels) {
+                double ll = fitWith(rs, os, nz);
+                if (ll > best) {
+                    best = ll;
+                    bestRate = rs;
+                    bestOther = os;
+                    bestNoise = nz;
+                }
+            }
+        }
+    }
+    if (best <= -1e300) {
+        alpha.clear();
+        return false;
+    }
+    fitWith(bestRate, bestOther, bestNoise);
+    return true;
+}
+
+void runner::gaussianProcess::predict(const std::vector<double> &x, double &mean, double &variance) const
+{
+    size_t n = inputs.size();
+    std::vector<double> k(n), v(n);
+    for (size_t i = 0; i < n; i++)
+        k.at(i) = kernel(x, inputs.at(i), rateScale, otherScale);
+
+    double m = 0;
+    for (size_t i = 0; i < n; i++)
+        m += k.at(i) * alpha.at(i);
+    // v = L^-1 k
+    double vv = 0;
+    for (size_t i = 0; i < n; i++) {
+        double sum = k.at(i);
+        for (size_t j = 0; j < i; j++)
+            sum -= chol.at(i).at(j) * v.at(j);
+        v.at(i) = sum / chol.at(i).at(i);
+        vv += v.at(i) * v.at(i);
+    }
+    mean = yMean + m * yScale;
+    variance = std::max(1e-12, 1.0 - vv) * yScale * yScale;
+}
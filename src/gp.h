@@ -0,0 +1,52 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace runner
+{
+    // Gaussian process regression with a squared exponential kernel and one length scale per input.
+    // Targets are standardized internally. The length scales and noise level are picked from a small
+    // grid by marginal likelihood, which is plenty for the few dozen encodes a session has.
+    class gaussianProcess {
+    public:
+        // rateDims is how many leading inputs share the first length scale, the rest share the second
+        bool fit(const std::vector<std::vector<double> > &x, const std::vector<double> &y, int rateDims = 1);
+        void predict(const std::vector<double> &x, double &mean, double &variance) const;
+        bool fitted() const { return !alpha.empty(); }
+
+    private:
+        double kernel(const std::vector<double> &a, const std::vector<double> &b, double rateScale, double otherScale) const;
+        // Fits with fixed hyperparameters, returns the log marginal likelihood or a very negative value on failure
+        double fitWith(double rateScale, double otherScale, double noise);
+
+        std::vector<std::vector<double> > inputs;
+        std::vector<double> targets;
+        int rateDims = 1;
+        double yMean = 0, yScale = 1;
+        double rateScale = 1, otherScale = 1, noise = 1e-2;
+        // Lower triangular Cholesky factor of K + noise I, and (K + noise I)^-1 y
+        std::vector<std::vector<double> > chol;
+        std::vector<double> alpha;
+    };
+
+    double normalPdf(double z);
+    double normalCdf(double z);
+};
@@ -0,0 +1,124 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ivf.h"
+#include <algorithm>
+#include <string.h>
+
+namespace {
+    const size_t ivfFileHeaderSize = 32;
+    const size_t ivfFrameHeaderSize = 12;
+
+    uint32_t readLE32(const uint8_t *p)
+    {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    uint64_t readLE64(const uint8_t *p)
+    {
+        return (uint64_t) readLE32(p) | ((uint64_t) readLE32(p + 4) << 32);
+    }
+
+    void writeLE32(uint8_t *p, uint32_t v)
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = (uint8_t) (v >> (8 * i));
+    }
+
+    void writeLE64(uint8_t *p, uint64_t v)
+    {
+        writeLE32(p, (uint32_t) v);
+        writeLE32(p + 4, (uint32_t) (v >> 32));
+    }
+}
+
+bool runner::ivfReader::feed(const uint8_t *data, size_t size, const packetCallback &onPacket)
+{
+    if (!valid)
+        return false;
+    buffer.insert(buffer.end(), data, data + size);
+
+    size_t pos = 0;
+    if (!headerRead) {
+        if (buffer.size() < ivfFileHeaderSize)
+            return true;
+        if (memcmp(buffer.data(), "DKIF", 4) != 0) {
+            valid = false;
+            return false;
+        }
+        size_t headerSize = buffer[6] | (buffer[7] << 8);
+        if (headerSize < ivfFileHeaderSize)
+            headerSize = ivfFileHeaderSize;
+        if (buffer.size() < headerSize)
+            return true;
+        pos = headerSize;
+        headerRead = true;
+    }
+
+    while (buffer.size() - pos >= ivfFrameHeaderSize) {
+        size_t frameSize = readLE32(buffer.data() + pos);
+        if (buffer.size() - pos - ivfFrameHeaderSize < frameSize)
+            break;
+        int64_t pts = (int64_t) readLE64(buffer.data() + pos + 4);
+        onPacket(buffer.data() + pos + ivfFrameHeaderSize, frameSize, pts);
+        frameCount++;
+        pos += ivfFrameHeaderSize + frameSize;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    return true;
+}
+
+bool runner::ivfJoiner::append(const std::vector<uint8_t> &stream)
+{
+    if (stream.size() < ivfFileHeaderSize || memcmp(stream.data(), "DKIF", 4) != 0)
+        return false;
+    size_t headerSize = stream[6] | (stream[7] << 8);
+    if (headerSize < ivfFileHeaderSize)
+        headerSize = ivfFileHeaderSize;
+    if (stream.size() < headerSize)
+        return false;
+    if (out.empty())
+        out.insert(out.end(), stream.begin(), stream.begin() + headerSize);
+
+    size_t pos = headerSize;
+    int64_t firstPts = 0, lastPts = -1;
+    bool first = true;
+    while (stream.size() - pos >= ivfFrameHeaderSize) {
+        size_t frameSize = readLE32(stream.data() + pos);
+        if (stream.size() - pos - ivfFrameHeaderSize < frameSize)
+            return false;
+        int64_t pts = (int64_t) readLE64(stream.data() + pos + 4);
+        if (first)
+            firstPts = pts;
+        first = false;
+        lastPts = std::max(lastPts, pts - firstPts);
+
+        uint8_t header[ivfFrameHeaderSize];
+        writeLE32(header, frameSize);
+        writeLE64(header + 4, (uint64_t) (pts - firstPts + nextPts));
+        out.insert(out.end(), header, header + ivfFrameHeaderSize);
+        out.insert(out.end(), stream.begin() + pos + ivfFrameHeaderSize, stream.begin() + pos + ivfFrameHeaderSize + frameSize);
+        frameCount++;
+        pos += ivfFrameHeaderSize + frameSize;
+    }
+    if (pos != stream.size())
+        return false;
+    nextPts += lastPts + 1;
+    writeLE32(out.data() + 24, frameCount);
+    return true;
+}
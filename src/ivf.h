@@ -0,0 +1,63 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+namespace runner
+{
+    // Incremental parser for the IVF container aomenc writes, so an encode can be consumed
+    // as it streams out of the encoder instead of from a finished file.
+    class ivfReader {
+    public:
+        typedef std::function<void(const uint8_t *data, size_t size, int64_t pts)> packetCallback;
+
+        // Appends raw bytes of the stream and calls onPacket for every frame that is now complete.
+        // Returns false if the stream is not IVF.
+        bool feed(const uint8_t *data, size_t size, const packetCallback &onPacket);
+
+        long frames() const { return frameCount; }
+
+    private:
+        std::vector<uint8_t> buffer;
+        bool headerRead = false;
+        bool valid = true;
+        long frameCount = 0;
+    };
+
+    // Joins IVF streams that were encoded separately, such as the chunks of one encode, into a single stream.
+    // The first stream's file header is kept with its frame count updated, and the timestamps of every later
+    // stream are shifted to follow on from the one before.
+    class ivfJoiner {
+    public:
+        // Adds a complete stream. Returns false if it is not IVF or is cut short.
+        bool append(const std::vector<uint8_t> &stream);
+
+        const std::vector<uint8_t> &data() const { return out; }
+        long frames() const { return frameCount; }
+
+    private:
+        std::vector<uint8_t> out;
+        int64_t nextPts = 0;
+        long frameCount = 0;
+    };
+};
@@ -19,6 +19,7 @@
 #include <iostream>
 #include <getopt.h>
 #include "runner.h"
+#include "fakeencoder.h"
 
 void printHelpMenu() {
     std::cout << "Smart Convergent Video - SCV options" << std::endl;
@@ -26,27 +27,54 @@ void printHelpMenu() {
     std::cout << std::endl;
     std::cout << "Options:" << std::endl;
     std::cout << " -i file\tInput video file" << std::endl;
-    std::cout << " -V file\tInput VMAF model. (defaults to /usr/share/model/vmaf_v0.6.1.pkl)" << std::endl;
+    std::cout << " -e name\tEncoder to search, one of aomenc, SvtAv1EncApp, rav1e, x264, x265 or fake, a stand-in mpeg4 encoder\nbuilt into scv for trying out a search without an encoder installed. (defaults to aomenc)" << std::endl;
+    std::cout << " -V model\tVMAF model. Either a model file or the name of a model built into libvmaf. (defaults to vmaf_v0.6.1)" << std::endl;
+    std::cout << " -v value\tNumber of threads libvmaf uses to score each trial. (defaults to 0, single threaded)" << std::endl;
     std::cout << " -o folder\tTemporary storage location" << std::endl;
+    std::cout << " -m folder\tWhere to keep the decoded reference video. A tmpfs such as /dev/shm keeps it in memory. (defaults to the temporary storage location)" << std::endl;
+    std::cout << " -H\t\tAsk for huge pages when mapping the decoded reference. Only helps when it is kept on tmpfs." << std::endl;
+    std::cout << " -c folder\tKeep decoded references in this folder between sessions, such as ~/.cache/scv/references. (defaults to off)" << std::endl;
+    std::cout << " -C value\tSize budget of the reference cache in MB, least recently used references are removed first. 0 disables the cache. (defaults to 20480)" << std::endl;
+    std::cout << " -R file\tWhere to keep the results of past sessions, which seed the searches for similar clips. Use - to disable. (defaults to ~/.local/share/scv/results.log)" << std::endl;
+    std::cout << " -E\t\tCount cycles, instructions, cache and branch misses of every encoder pass and add them to the results." << std::endl;
+    std::cout << " -u value\tScore vmaf on every value-th frame and rescore more densely when that is too close to call (defaults to 1)" << std::endl;
+    std::cout << " -L value\tFind the fast rate on the reference shrunk value times in each direction first, then finish at full resolution\nfrom that rate scaled by a ratio learned from past sessions. 2 searches on a quarter of the pixels (defaults to 0, off)" << std::endl;
+    std::cout << " -a list\tRun the encoders only on these cpus, such as 2-3,6, and check that their frequency governor is performance" << std::endl;
+    std::cout << " -r value\tTime every speed pass trial again, up to 10 times, until the 95% confidence interval of its time is narrower\nthan value times the mean, and report the spread in the CSV. 0.05 is a good start (defaults to 0, time once)" << std::endl;
+    std::cout << " -M\t\tScore every fast rate trial with vmaf instead of switching to PSNR / SSIM calibrated against it.\nWith -Q the fast rate pass picks the final cq-level, so it always uses vmaf" << std::endl;
+    std::cout << " -Y value\tScore trials on this many threads of their own, so the speed pass moves on as soon as a trial is encoded\nand the exact bitrate pass can speculate on its next probe. (defaults to 0, every trial is scored as it encodes)" << std::endl;
+    std::cout << " -j value\tNumber of trials to run at once. Every trial gets its own folder inside the temporary storage location." << std::endl;
 
     std::cout << " -O file\tOutput to csv file" << std::endl;
     std::cout << " -t timescale\tSolve for ideal compiler settings by solving for a desired encoder timescale\n(target number of seconds of video to encode for every second of execution time)" << std::endl;
     std::cout << " -T value\tSolve for ideal 'value' of compression.\nEG -T10 will think it's worth spending ten times as long to decrease output video size by a factor of 2" << std::endl;
     std::cout << "Setting -T to a negative value, eg -1, will instruct the encoder to use the slowest speed settings and avoid optimizing for time used." << std::endl;
+    std::cout << " -F file\tInstead of one ideal setting, find every setting that no other beats on both time and size at the target vmaf,\nand write them to file. Use - to only print them." << std::endl;
+    std::cout << " -N value\tMost encoder settings to try with -F. (defaults to 16)" << std::endl;
     std::cout << " -p\t\tMeasure time using realtime rather than cpu time. This is not recommended as CPU time is a more useful metric for encoding performance as encoding is highly parallelizable." << std::endl;
     std::cout << " -P value\tExtrapolate the total system performance when finding timescale given value cores." << std::endl;
     std::cout << "As performance may not scale linearly, this can be a decimal value.\n" << std::endl;
+    std::cout << " -W\t\tLet speed pass trials run to the end even once they are certainly too slow for the -t target." << std::endl;
+    std::cout << " -B\t\tMeasure how the encoder scales with threads on a short segment and use that instead of linear scaling for -P." << std::endl;
 
     std::cout << " -q value\tTarget VMAF of the output video (ranges from 0-100)" << std::endl;
     std::cout << " -Q value\tAcceptable VMAF deviation from target for output video. Defaults to 0.05" << std::endl;
     std::cout << "Setting -Q to a negative value uses q factor instead of bitrate. Not recommended.\n" << std::endl;
-    std::cout << " -M file\tModel file to use for VMAF calculation. Be sure it's appropriate for your video resolution." << std::endl;
+    std::cout << " -X name\tOptimizer, either passes (the sequential rate, speed and exact rate passes, the default) or surrogate,\nwhich models every encode so far and picks each next encode by expected improvement. Falls back to passes if it finds nothing." << std::endl;
+    std::cout << " -g value\tMost encodes the surrogate optimizer spends before it settles on the best one so far. (defaults to 30)" << std::endl;
+    std::cout << " -s value\tSearch on this many short segments of the input instead of all of it. Segments start at scene cuts where possible\nand are spread over the range of motion in the clip. (defaults to 0, off)" << std::endl;
+    std::cout << " -l value\tLength in seconds of every segment with -s. (defaults to 2)" << std::endl;
+    std::cout << " -f\t\tWith -s, encode the whole input once more with the chosen settings and report how far off the segments were." << std::endl;
+    std::cout << " -J value\tSplit every trial into this many chunks at scene cuts and encode them at once as separate encoder processes,\nthe way a chunked encoding pipeline does. Cpu time is summed over the chunks and real time is the slowest chunk." << std::endl;
+    std::cout << " -A\t\tDo not analyze the source to predict the starting bitrate and speed." << std::endl;
+    std::cout << " -S name\tRate search strategy, either secant (interpolates in log bitrate, the default) or bisect." << std::endl;
     std::cout << " -y value\tRescale the video to a height when testing VMAF. (defaults to 720, use 0 to disable any rescaling)." << std::endl;
     std::cout << " -x value\tRescale the video to a width when testing VMAF. (defaults to preserving the aspect ratio)." << std::endl;
     std::cout << " -0\t\tOutput to and test with 10 bit video. Uses the yuv420p10le format." << std::endl;
     std::cout << " -2\t\tOutput to and test with 12 bit video. Uses the yuv420p12le format." << std::endl;
-    std::cout << " -k\tTest speed impact of forward keyframes (experimental)" << std::endl;
-    std::cout << " -K\tTest speed impact of alternative tunings (experimental)" << std::endl;
+    std::cout << " -k\tTest speed impact of forward keyframes, aomenc only (experimental)" << std::endl;
+    std::cout << " -K\tTest speed impact of alternative tunings, aomenc, x264 and x265 only (experimental)" << std::endl;
+    std::cout << " -D name\tAlso sweep this encoder parameter in the speed pass, can be repeated. Such as LagInFrames, AutoAltRef or ArnrMaxFrames for aomenc (experimental)" << std::endl;
 
     std::cout << " -n\t\tDo not use 2 pass (VERY NOT RECOMMENDED) for encoding." << std::endl;
 
@@ -64,10 +92,14 @@ double getDouble(char* str, double def = 0.0)
 
 
 int main(int argc, char **argv) {
+    // scv runs itself as the fake encoder backend
+    if (argc > 1 && std::string(argv[1]) == "--fake-encoder")
+        return runner::runFakeEncoder(argc, argv);
+
     struct runner::runSettings rs;
     int opt;
 
-    while((opt = getopt(argc, argv, ":V:i:o:t:T:q:Q:O:x:y:02pnhkKP:")) != -1){ //get option from the getopt() method
+    while((opt = getopt(argc, argv, ":V:i:o:t:T:q:Q:O:x:y:02pnhkKP:j:v:m:Hc:C:S:EBD:F:N:X:AR:s:l:fJ:WY:Mu:L:a:r:e:g:")) != -1){ //get option from the getopt() method
         switch(opt){
 
             //For option i, r, l, print that these are options
@@ -120,10 +152,96 @@ int main(int argc, char **argv) {
                 rs.useCPUTime = false;
                 break;
             case 'k':
-                rs.testFwdFrames = true;
+                rs.searchedParameters.push_back("FwdKF");
                 break;
             case 'K':
-                rs.testAlternativeTunings = true;
+                rs.searchedParameters.push_back("Tune");
+                break;
+            case 'm':
+                rs.frameStoreLocation = optarg;
+                break;
+            case 'H':
+                rs.useHugePages = true;
+                break;
+            case 'F':
+                rs.frontierMode = true;
+                if (std::string(optarg) != "-")
+                    rs.frontierCSVFile = optarg;
+                break;
+            case 'N':
+                rs.frontierPoints = (int) getDouble(optarg, rs.frontierPoints);
+                break;
+            case 's':
+                rs.sampleSegments = (long) getDouble(optarg, rs.sampleSegments);
+                break;
+            case 'l':
+                rs.sampleSeconds = getDouble(optarg, rs.sampleSeconds);
+                break;
+            case 'f':
+                rs.verifySampling = true;
+                break;
+            case 'J':
+                rs.chunks = (int) getDouble(optarg, rs.chunks);
+                break;
+            case 'A':
+                rs.analyzeContent = false;
+                break;
+            case 'X':
+                rs.optimizer = optarg;
+                break;
+            case 'g':
+                rs.surrogateBudget = (long) getDouble(optarg, rs.surrogateBudget);
+                break;
+            case 'e':
+                rs.encodingProgram = optarg;
+                break;
+            case 'D':
+                rs.searchedParameters.push_back(optarg);
+                break;
+            case 'W':
+                rs.stopSlowTrials = false;
+                break;
+            case 'B':
+                rs.measureScaling = true;
+                break;
+            case 'E':
+                rs.countHardwareEvents = true;
+                break;
+            case 'c':
+                rs.referenceCacheLocation = optarg;
+                break;
+            case 'C':
+                rs.referenceCacheBudget = (long long) (getDouble(optarg, rs.referenceCacheBudget / 1024.0 / 1024.0) * 1024 * 1024);
+                break;
+            case 'R':
+                rs.resultStoreLocation = optarg;
+                break;
+            case 'S':
+                rs.rateSearchStrategy = optarg;
+                break;
+            case 'v':
+                rs.vmafThreads = (int) getDouble(optarg, rs.vmafThreads);
+                break;
+            case 'u':
+                rs.vmafSubsample = (int) getDouble(optarg, rs.vmafSubsample);
+                break;
+            case 'L':
+                rs.coarseScale = (int) getDouble(optarg, rs.coarseScale);
+                break;
+            case 'a':
+                rs.pinCpus = optarg;
+                break;
+            case 'r':
+                rs.timingPrecision = getDouble(optarg, rs.timingPrecision);
+                break;
+            case 'M':
+                rs.proxyMetric = false;
+                break;
+            case 'Y':
+                rs.pipelineScorers = (int) getDouble(optarg, rs.pipelineScorers);
+                break;
+            case 'j':
+                rs.jobs = (int) getDouble(optarg, rs.jobs);
                 break;
             case ':':
                 std::cout << "ERROR... option needs a value specified" << std::endl;
@@ -137,6 +255,10 @@ int main(int argc, char **argv) {
                 return 0;
         }
     }
+    if (rs.vmafEpsilon < 0) {
+        rs.useQFactor = true;
+        rs.vmafEpsilon = -rs.vmafEpsilon;
+    }
     if (rs.inputFile == "") {
         std::cout << "Please provide an input video file to test with -i file" << std::endl;
         return 0;
@@ -175,6 +297,11 @@ int main(int argc, char **argv) {
         else
             std::cout << "Will target encoding " << rs.timescaleTarget << "s of video per second." << std::endl << "Do not turn off your computer during this time" << std::endl;
     }
+    if (rs.jobs > 1) {
+        std::cout << "Running up to " << rs.jobs << " trials at once" << std::endl;
+        if (!rs.useCPUTime)
+            std::cout << "WARNING: real time measurements are shared between concurrent trials. Consider using cpu time." << std::endl;
+    }
     if (!rs.useTwoPass) {
         std::cout << "WARNING: running with 1 pass video" << std::endl;
     }
@@ -0,0 +1,383 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "paramspace.h"
+
+std::string runner::paramPoint::key() const
+{
+    std::string k;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (i > 0)
+            k += "_";
+        k += std::to_string(values.at(i));
+    }
+    return k;
+}
+
+void runner::parameterSpace::addDimension(const paramDimension &dimension)
+{
+    dims.push_back(dimension);
+}
+
+void runner::parameterSpace::setSweepOrder(const std::vector<std::string> &names)
+{
+    order.clear();
+    for (size_t i = 0; i < names.size(); i++) {
+        int d = find(names.at(i));
+        if (d >= 0)
+            order.push_back(d);
+    }
+}
+
+void runner::parameterSpace::setConstraint(const std::function<bool(const paramPoint &)> &c)
+{
+    constraint = c;
+}
+
+int runner::parameterSpace::find(const std::string &name) const
+{
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (dims.at(i).name == name)
+            return i;
+    }
+    return -1;
+}
+
+runner::paramPoint runner::parameterSpace::defaults() const
+{
+    paramPoint p;
+    for (size_t i = 0; i < dims.size(); i++)
+        p.values.push_back(dims.at(i).defaultIndex);
+    return p;
+}
+
+bool runner::parameterSpace::valid(const paramPoint &p) const
+{
+    if (p.values.size() != dims.size())
+        return false;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (p.values.at(i) < -1 || p.values.at(i) >= (int) dims.at(i).values.size())
+            return false;
+    }
+    return !constraint || constraint(p);
+}
+
+bool runner::parameterSpace::set(paramPoint &p, const std::string &name, const std::string &label) const
+{
+    int d = find(name);
+    if (d < 0 || p.values.size() != dims.size())
+        return false;
+    for (size_t i = 0; i < dims.at(d).values.size(); i++) {
+        if (dims.at(d).values.at(i).label == label) {
+            p.values.at(d) = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string runner::parameterSpace::label(const paramPoint &p, size_t dimension) const
+{
+    int v = p.values.at(dimension);
+    if (v < 0)
+        return "default";
+    return dims.at(dimension).values.at(v).label;
+}
+
+std::string runner::parameterSpace::arguments(const paramPoint &p) const
+{
+    std::string args;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (p.values.at(i) >= 0)
+            args += dims.at(i).values.at(p.values.at(i)).args;
+    }
+    return args;
+}
+
+std::string runner::parameterSpace::explain(const paramPoint &p) const
+{
+    std::string e;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (i > 0)
+            e += "\n";
+        e += "Using " + dims.at(i).description + ": " + label(p, i);
+    }
+    return e;
+}
+
+std::string runner::parameterSpace::csvHeader() const
+{
+    std::string h;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (i > 0)
+            h += ", ";
+        h += dims.at(i).name;
+    }
+    return h;
+}
+
+std::string runner::parameterSpace::csvRow(const paramPoint &p) const
+{
+    std::string r;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (i > 0)
+            r += ", ";
+        r += label(p, i);
+    }
+    return r;
+}
+
+bool runner::parameterSpace::onePass(const paramPoint &p) const
+{
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (p.values.at(i) >= 0 && dims.at(i).values.at(p.values.at(i)).onePass)
+            return true;
+    }
+    return false;
+}
+
+double runner::parameterSpace::relativeCost(const paramPoint &p) const
+{
+    double cost = 1;
+    for (size_t i = 0; i < dims.size(); i++) {
+        if (p.values.at(i) >= 0)
+            cost *= dims.at(i).values.at(p.values.at(i)).relativeCost;
+    }
+    return cost;
+}
+
+runner::paramSweep::paramSweep(const parameterSpace &space, const std::vector<std::string> &searched) : space(space)
+{
+    for (size_t i = 0; i < searched.size(); i++) {
+        if (space.find(searched.at(i)) < 0 && unknown.empty())
+            unknown = searched.at(i);
+    }
+    const std::vector<int> &order = space.sweepOrder();
+    for (size_t i = 0; i < order.size(); i++) {
+        for (size_t s = 0; s < searched.size(); s++) {
+            if (space.find(searched.at(s)) == order.at(i)) {
+                searchedOrder.push_back(order.at(i));
+                break;
+            }
+        }
+    }
+}
+
+bool runner::paramSweep::advance(paramPoint &p) const
+{
+    for (size_t k = 0; k < searchedOrder.size(); k++) {
+        int d = searchedOrder.at(k);
+        if (p.values.at(d) + 1 < (int) space.dimensions().at(d).values.size()) {
+            p.values.at(d)++;
+            for (size_t j = 0; j < k; j++)
+                p.values.at(searchedOrder.at(j)) = space.dimensions().at(searchedOrder.at(j)).resetIndex;
+            return true;
+        }
+    }
+    return false;
+}
+
+runner::paramPoint runner::paramSweep::first() const
+{
+    paramPoint p = space.defaults();
+    for (size_t k = 0; k < searchedOrder.size(); k++)
+        p.values.at(searchedOrder.at(k)) = 0;
+    if (space.valid(p))
+        return p;
+    paramPoint valid;
+    if (next(p, valid))
+        return valid;
+    return p;
+}
+
+runner::paramPoint runner::paramSweep::last() const
+{
+    paramPoint p = first();
+    paramPoint following;
+    while (next(p, following))
+        p = following;
+    return p;
+}
+
+bool runner::paramSweep::next(const paramPoint &from, paramPoint &to) const
+{
+    paramPoint p = from;
+    while (advance(p)) {
+        if (space.valid(p)) {
+            to = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool runner::paramSweep::isLast(const paramPoint &p) const
+{
+    paramPoint following;
+    return !next(p, following);
+}
+
+namespace {
+    // option ends in whatever separates it from its value, "=" or " "
+    runner::paramDimension dimension(const std::string &name, const std::string &description, const std::string &option,
+                                     const std::vector<std::string> &labels, int defaultIndex = -1, int resetIndex = 0,
+                                     const std::vector<double> &costs = std::vector<double>())
+    {
+        runner::paramDimension d;
+        d.name = name;
+        d.description = description;
+        d.defaultIndex = defaultIndex;
+        d.resetIndex = resetIndex;
+        for (size_t i = 0; i < labels.size(); i++) {
+            runner::paramValue v;
+            v.label = labels.at(i);
+            v.args = " " + option + labels.at(i);
+            if (i < costs.size())
+                v.relativeCost = costs.at(i);
+            d.values.push_back(v);
+        }
+        return d;
+    }
+
+    runner::parameterSpace makeAomencParameters()
+    {
+        runner::parameterSpace space;
+        space.addDimension(dimension("Speed", "cpu speed", "--cpu-used=", {"8", "7", "6", "5", "4", "3", "2", "1", "0"}, 4, 0,
+                                     {1, 1.3, 1.7, 2.3, 3.2, 5, 8, 14, 30}));
+        space.addDimension(dimension("Tune", "tuning", "--tune=", {"psnr", "ssim", "vmaf_without_preprocessing", "vmaf_with_preprocessing"}, 0, 0,
+                                     {1, 1.05, 1.3, 1.6}));
+        space.addDimension(dimension("FwdKF", "forward keyframes", "--enable-fwd-kf=", {"0", "1"}, 0));
+
+        runner::paramDimension deadline;
+        deadline.name = "RTDeadline";
+        deadline.description = "realtime deadline";
+        runner::paramValue rt;
+        rt.label = "1";
+        rt.args = " --rt";
+        rt.onePass = true;
+        runner::paramValue good;
+        good.label = "0";
+        good.args = " --good";
+        good.relativeCost = 2.5;
+        deadline.values = {rt, good};
+        // Once the realtime speeds have been tried, later sweeps only need the good deadline
+        deadline.defaultIndex = 1;
+        deadline.resetIndex = 1;
+        space.addDimension(deadline);
+
+        space.addDimension(dimension("LagInFrames", "lookahead frames", "--lag-in-frames=", {"0", "8", "16", "24", "35", "48"}, -1, 0,
+                                     {1, 1.05, 1.1, 1.15, 1.2, 1.25}));
+        space.addDimension(dimension("AutoAltRef", "alt-ref frames", "--auto-alt-ref=", {"0", "1"}, -1, 0, {1, 1.1}));
+        space.addDimension(dimension("ArnrMaxFrames", "alt-ref filter frames", "--arnr-maxframes=", {"0", "3", "5", "7", "11", "15"}, -1, 0,
+                                     {1, 1.05, 1.08, 1.1, 1.15, 1.2}));
+
+        space.setSweepOrder({"Speed", "RTDeadline", "LagInFrames", "ArnrMaxFrames", "AutoAltRef", "FwdKF", "Tune"});
+
+        // The realtime deadline only goes down to cpu-used 4, good only up to 5
+        int speedDim = space.find("Speed");
+        int deadlineDim = space.find("RTDeadline");
+        space.setConstraint([speedDim, deadlineDim] (const runner::paramPoint &p) -> bool {
+            int cpuUsed = 8 - p.values.at(speedDim);
+            bool realtime = p.values.at(deadlineDim) == 0;
+            if (realtime)
+                return cpuUsed >= 4;
+            return cpuUsed <= 5;
+        });
+        return space;
+    }
+
+    runner::parameterSpace makeSvtAv1Parameters()
+    {
+        runner::parameterSpace space;
+        space.addDimension(dimension("Speed", "preset", "--preset ", {"12", "11", "10", "9", "8", "7", "6", "5", "4", "3", "2", "1", "0"}, 4, 0,
+                                     {1, 1.1, 1.3, 1.6, 2, 2.6, 3.5, 5, 7.5, 11, 18, 30, 60}));
+        space.addDimension(dimension("LookAhead", "lookahead frames", "--lookahead ", {"0", "16", "32", "64", "120"}, -1, 0,
+                                     {1, 1.05, 1.1, 1.15, 1.2}));
+        space.addDimension(dimension("ScD", "scene change detection", "--scd ", {"0", "1"}, -1, 0, {1, 1.02}));
+        space.setSweepOrder({"Speed", "LookAhead", "ScD"});
+        return space;
+    }
+
+    runner::parameterSpace makeRav1eParameters()
+    {
+        runner::parameterSpace space;
+        space.addDimension(dimension("Speed", "speed", "--speed ", {"10", "9", "8", "7", "6", "5", "4", "3", "2", "1", "0"}, 4, 0,
+                                     {1, 1.2, 1.5, 2, 2.5, 3.2, 4.5, 6, 9, 14, 25}));
+        space.addDimension(dimension("RdoLookahead", "rdo lookahead frames", "--rdo-lookahead-frames ", {"10", "20", "40"}, -1, 0,
+                                     {1, 1.1, 1.2}));
+        space.setSweepOrder({"Speed", "RdoLookahead"});
+        return space;
+    }
+
+    // x264 and x265 share their preset names
+    runner::parameterSpace makeX26xParameters(const std::vector<double> &presetCosts)
+    {
+        runner::parameterSpace space;
+        space.addDimension(dimension("Speed", "preset", "--preset ", {"ultrafast", "superfast", "veryfast", "faster", "fast", "medium",
+                                     "slow", "slower", "veryslow", "placebo"}, 5, 0, presetCosts));
+        space.addDimension(dimension("Tune", "tuning", "--tune ", {"psnr", "ssim"}, -1, 0));
+        space.addDimension(dimension("RcLookahead", "rate control lookahead frames", "--rc-lookahead ", {"10", "20", "40", "60"}, -1, 0,
+                                     {1, 1.03, 1.06, 1.1}));
+        space.setSweepOrder({"Speed", "RcLookahead", "Tune"});
+        return space;
+    }
+
+    runner::parameterSpace makeFakeParameters()
+    {
+        runner::parameterSpace space;
+        space.addDimension(dimension("Speed", "effort", "--speed=", {"0", "1", "2", "3"}, 1, 0, {1, 1.5, 2.5, 4}));
+        space.setSweepOrder({"Speed"});
+        return space;
+    }
+}
+
+const runner::parameterSpace &runner::aomencParameters()
+{
+    static const parameterSpace space = makeAomencParameters();
+    return space;
+}
+
+const runner::parameterSpace &runner::svtAv1Parameters()
+{
+    static const parameterSpace space = makeSvtAv1Parameters();
+    return space;
+}
+
+const runner::parameterSpace &runner::rav1eParameters()
+{
+    static const parameterSpace space = makeRav1eParameters();
+    return space;
+}
+
+const runner::parameterSpace &runner::x264Parameters()
+{
+    static const parameterSpace space = makeX26xParameters({1, 1.3, 1.8, 2.5, 3.2, 4, 6, 9, 16, 45});
+    return space;
+}
+
+const runner::parameterSpace &runner::x265Parameters()
+{
+    static const parameterSpace space = makeX26xParameters({1, 1.4, 2, 2.4, 3, 4, 8, 12, 30, 60});
+    return space;
+}
+
+const runner::parameterSpace &runner::fakeEncoderParameters()
+{
+    static const parameterSpace space = makeFakeParameters();
+    return space;
+}
@@ -0,0 +1,133 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // One setting of every dimension of a parameterSpace, as an index into that dimension's values.
+    // -1 leaves the dimension to the encoder's own default.
+    struct paramPoint {
+        std::vector<int> values;
+
+        bool operator==(const paramPoint &other) const { return values == other.values; }
+        bool operator!=(const paramPoint &other) const { return values != other.values; }
+        // Short stable name for caches, eg "3_1_0_0_-1"
+        std::string key() const;
+    };
+
+    struct paramValue {
+        // Shown in the results and the csv
+        std::string label;
+        // Passed to the encoder, with a leading space
+        std::string args;
+        // Rules out two pass encoding, eg the realtime deadline
+        bool onePass = false;
+        // Rough encode time relative to the fastest value of the dimension
+        double relativeCost = 1;
+    };
+
+    struct paramDimension {
+        // Csv column
+        std::string name;
+        std::string description;
+        // Ordered from fastest to slowest
+        std::vector<paramValue> values;
+        // Value used while the dimension is not searched, -1 leaves it to the encoder
+        int defaultIndex = -1;
+        // Value the dimension restarts from when a dimension further out in the sweep advances
+        int resetIndex = 0;
+    };
+
+    // The encoder settings that trade speed for size, with their values in speed order, the order they are
+    // swept in and which combinations the encoder accepts. Command lines, explanations and csv columns are
+    // all generated from it.
+    class parameterSpace {
+    public:
+        void addDimension(const paramDimension &dimension);
+        // Dimensions listed first change fastest in a sweep. Dimensions left out are never swept.
+        void setSweepOrder(const std::vector<std::string> &names);
+        void setConstraint(const std::function<bool(const paramPoint &)> &constraint);
+
+        // Returns -1 for an unknown name
+        int find(const std::string &name) const;
+        const std::vector<paramDimension> &dimensions() const { return dims; }
+        const std::vector<int> &sweepOrder() const { return order; }
+
+        // Every dimension at its default
+        paramPoint defaults() const;
+        bool valid(const paramPoint &p) const;
+        // Sets a dimension by value label, returns false if there is no such dimension or value
+        bool set(paramPoint &p, const std::string &name, const std::string &label) const;
+
+        std::string label(const paramPoint &p, size_t dimension) const;
+        std::string arguments(const paramPoint &p) const;
+        std::string explain(const paramPoint &p) const;
+        std::string csvHeader() const;
+        std::string csvRow(const paramPoint &p) const;
+        bool onePass(const paramPoint &p) const;
+        // Product of the relative costs of every set value, for predicting encode times from one measurement
+        double relativeCost(const paramPoint &p) const;
+
+    private:
+        std::vector<paramDimension> dims;
+        std::vector<int> order;
+        std::function<bool(const paramPoint &)> constraint;
+    };
+
+    // Walks a parameterSpace from the fastest valid point to the slowest, varying only the searched dimensions.
+    // Like an odometer in sweep order, except that inner dimensions restart from their resetIndex.
+    class paramSweep {
+    public:
+        paramSweep(const parameterSpace &space, const std::vector<std::string> &searched);
+
+        // The first searched name that is not in the space, empty if there is none
+        const std::string &unknownName() const { return unknown; }
+        // Indices of the searched dimensions, in sweep order
+        const std::vector<int> &searchedDimensions() const { return searchedOrder; }
+
+        paramPoint first() const;
+        paramPoint last() const;
+        // Returns false when from is the last point
+        bool next(const paramPoint &from, paramPoint &to) const;
+        bool isLast(const paramPoint &p) const;
+
+    private:
+        bool advance(paramPoint &p) const;
+
+        const parameterSpace &space;
+        std::vector<int> searchedOrder;
+        std::string unknown;
+    };
+
+    // aomenc's deadline, cpu-used, tune and keyframe placement plus the lookahead and alt-ref knobs
+    const parameterSpace &aomencParameters();
+    // SvtAv1EncApp's preset, lookahead and scene change detection
+    const parameterSpace &svtAv1Parameters();
+    // rav1e's speed and rdo lookahead
+    const parameterSpace &rav1eParameters();
+    // The x264 and x265 presets, tunings and rate control lookahead
+    const parameterSpace &x264Parameters();
+    const parameterSpace &x265Parameters();
+    // The effort levels of the stand-in encoder built into scv, see fakeencoder.h
+    const parameterSpace &fakeEncoderParameters();
+};
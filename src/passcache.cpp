@@ -0,0 +1,73 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "passcache.h"
+#include <stdio.h>
+#include <unistd.h>
+
+runner::firstPassCache::firstPassCache(const std::string &directory) : directory(directory)
+{
+}
+
+runner::firstPassCache::~firstPassCache()
+{
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        remove(it->second.passFile.c_str());
+    }
+    rmdir(directory.c_str());
+}
+
+std::string runner::firstPassCache::key(const singleRun &sr)
+{
+    std::string key = "params" + sr.params.key();
+    // Threading and the encoded segment change the statistics too
+    if (sr.threads > 0)
+        key += "-threads" + std::to_string(sr.threads);
+    if (sr.frameOffset > 0 || sr.frameLimit > 0)
+        key += "-frames" + std::to_string(sr.frameOffset) + "+" + std::to_string(sr.frameLimit);
+    return key;
+}
+
+bool runner::firstPassCache::lookup(const std::string &key, firstPassEntry &entry)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return false;
+    entry = it->second;
+    return true;
+}
+
+std::string runner::firstPassCache::store(const std::string &key, const std::string &passFile, const processUsage &usage, double realTime)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it != entries.end())
+        return passFile;
+
+    _mkdir(directory.c_str());
+    firstPassEntry entry;
+    entry.passFile = directory + "/" + key + ".dat";
+    entry.usage = usage;
+    entry.realTime = realTime;
+    if (rename(passFile.c_str(), entry.passFile.c_str()) != 0)
+        return passFile;
+
+    entries[key] = entry;
+    return entry.passFile;
+}
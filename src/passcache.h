@@ -0,0 +1,55 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace runner
+{
+    struct firstPassEntry {
+        std::string passFile;
+        processUsage usage;
+        double realTime = 0;
+    };
+
+    // aomenc's first pass statistics only depend on the encoder parameters, not on the
+    // target bitrate, so every probe after the first at the same settings can skip straight to pass 2.
+    // The cache owns its folder and removes it when destroyed.
+    class firstPassCache {
+    public:
+        firstPassCache(const std::string &directory);
+        ~firstPassCache();
+
+        static std::string key(const singleRun &sr);
+
+        bool lookup(const std::string &key, firstPassEntry &entry);
+
+        // Moves a finished pass file into the cache and returns the path pass 2 should read.
+        // If another trial cached the same settings first, passFile is left alone and returned.
+        std::string store(const std::string &key, const std::string &passFile, const processUsage &usage, double realTime);
+
+    private:
+        std::string directory;
+        std::map<std::string, firstPassEntry> entries;
+        std::mutex lock;
+    };
+};
@@ -0,0 +1,150 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perfcounters.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+namespace {
+    const uint64_t counterEvents[] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    const size_t counterCount = sizeof(counterEvents) / sizeof(counterEvents[0]);
+
+    // Group reads are not allowed on inherited counters, so every event gets its own fd
+    int openCounter(uint64_t config, pid_t pid, bool onExec)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.inherit = 1;
+        attr.disabled = onExec ? 1 : 0;
+        attr.enable_on_exec = onExec ? 1 : 0;
+        // User space only, this is all perf_event_paranoid 2 allows
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int) syscall(__NR_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    std::string paranoidLevel()
+    {
+        std::ifstream f("/proc/sys/kernel/perf_event_paranoid");
+        std::string level;
+        if (!(f >> level))
+            return "unknown";
+        return level;
+    }
+}
+
+bool runner::perfCountersAvailable()
+{
+    static std::once_flag probed;
+    static bool available = false;
+    std::call_once(probed, [] () {
+        int fd = openCounter(PERF_COUNT_HW_INSTRUCTIONS, 0, false);
+        if (fd >= 0) {
+            close(fd);
+            available = true;
+            return;
+        }
+        std::cout << "Hardware counters unavailable (" << strerror(errno) << ", perf_event_paranoid=" << paranoidLevel() << "), continuing without them" << std::endl;
+    });
+    return available;
+}
+
+runner::perfCounterSet::~perfCounterSet()
+{
+    closeAll();
+}
+
+void runner::perfCounterSet::closeAll()
+{
+    for (size_t i = 0; i < fds.size(); i++)
+        close(fds.at(i));
+    fds.clear();
+}
+
+bool runner::perfCounterSet::attach(pid_t pid)
+{
+    closeAll();
+    for (size_t i = 0; i < counterCount; i++) {
+        int fd = openCounter(counterEvents[i], pid, true);
+        if (fd < 0) {
+            closeAll();
+            return false;
+        }
+        fds.push_back(fd);
+    }
+    return true;
+}
+
+runner::perfCounts runner::perfCounterSet::read() const
+{
+    perfCounts counts;
+    if (fds.size() != counterCount)
+        return counts;
+
+    long long values[counterCount];
+    for (size_t i = 0; i < counterCount; i++) {
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (::read(fds.at(i), data, sizeof(data)) != (ssize_t) sizeof(data))
+            return counts;
+        double scaled = (double) data[0];
+        if (data[2] > 0 && data[2] < data[1])
+            scaled = scaled * data[1] / data[2];
+        values[i] = (long long) scaled;
+    }
+
+    counts.valid = true;
+    counts.cycles = values[0];
+    counts.instructions = values[1];
+    counts.cacheReferences = values[2];
+    counts.cacheMisses = values[3];
+    counts.branches = values[4];
+    counts.branchMisses = values[5];
+    return counts;
+}
+
+std::string runner::perfCsvHeader(const std::string &prefix)
+{
+    return ", " + prefix + "Cycles, " + prefix + "Instructions, " + prefix + "IPC, " + prefix + "CacheRefs, " + prefix + "CacheMisses, " + prefix + "Branches, " + prefix + "BranchMisses";
+}
+
+std::string runner::perfCsvRow(const perfCounts &counts)
+{
+    std::stringstream row;
+    row << ", " << counts.cycles << ", " << counts.instructions << ", " << counts.ipc() << ", " << counts.cacheReferences << ", " << counts.cacheMisses << ", " << counts.branches << ", " << counts.branchMisses;
+    return row.str();
+}
@@ -0,0 +1,70 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Hardware event counts for one encoder process and every thread or child it started.
+    // valid is false when the counters could not be opened, every count is then 0.
+    struct perfCounts {
+        bool valid = false;
+        long long cycles = 0;
+        long long instructions = 0;
+        long long cacheReferences = 0;
+        long long cacheMisses = 0;
+        long long branches = 0;
+        long long branchMisses = 0;
+
+        double ipc() const { return cycles > 0 ? (double) instructions / cycles : 0; }
+        double cacheMissRate() const { return cacheReferences > 0 ? (double) cacheMisses / cacheReferences : 0; }
+        double branchMissRate() const { return branches > 0 ? (double) branchMisses / branches : 0; }
+    };
+
+    // Checks once whether this process may open user space hardware counters at all, eg in a container with
+    // a restrictive perf_event_paranoid. Prints why not the first time it fails.
+    bool perfCountersAvailable();
+
+    // A set of counters following one process. They are opened disabled with enable_on_exec and inherit set,
+    // so they start counting when the child execs and include every thread it creates.
+    class perfCounterSet {
+    public:
+        perfCounterSet() {}
+        ~perfCounterSet();
+
+        // Opens the counters on pid, returns false if any of them could not be opened
+        bool attach(pid_t pid);
+        // Reads the final counts once the process has been reaped, scaling for multiplexing
+        perfCounts read() const;
+
+    private:
+        perfCounterSet(const perfCounterSet&);
+        perfCounterSet& operator=(const perfCounterSet&);
+        void closeAll();
+
+        std::vector<int> fds;
+    };
+
+    // Column names and values for the csv output, prefix is the pass, eg "P1"
+    std::string perfCsvHeader(const std::string &prefix);
+    std::string perfCsvRow(const perfCounts &counts);
+};
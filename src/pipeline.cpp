@@ -0,0 +1,230 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipeline.h"
+#include "timing.h"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+runner::trialPipeline::trialPipeline(const runSettings &rs, trialScheduler &scheduler, int scorers) :
+    rs(rs), scheduler(scheduler), encoders(scheduler.slots()), scorers(std::max(1, scorers)),
+    started(std::chrono::steady_clock::now()), lastChange(started)
+{
+    for (int i = 0; i < encoders; i++)
+        threads.push_back(std::thread(&trialPipeline::encodeWorker, this));
+    for (int i = 0; i < this->scorers; i++)
+        threads.push_back(std::thread(&trialPipeline::scoreWorker, this));
+}
+
+runner::trialPipeline::~trialPipeline()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        for (auto it = jobs.begin(); it != jobs.end(); ++it)
+            it->second->cancel = true;
+    }
+    changed.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+        threads.at(i).join();
+}
+
+void runner::trialPipeline::advanceClock()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastChange).count();
+    for (int g = 0; g < 4; g++)
+        gauges[g].weighted += gauges[g].current * elapsed;
+    lastChange = now;
+}
+
+void runner::trialPipeline::setState(job &j, jobState state)
+{
+    advanceClock();
+    if (j.state < done)
+        gauges[j.state].current--;
+    j.state = state;
+    if (state < done) {
+        gauges[state].current++;
+        gauges[state].peak = std::max(gauges[state].peak, gauges[state].current);
+    }
+}
+
+long runner::trialPipeline::submit(const singleRun &sr, bool speculative)
+{
+    std::unique_ptr<job> j(new job());
+    j->sr = sr;
+    j->ctx = scheduler.nextContext();
+    j->speculative = speculative;
+    std::lock_guard<std::mutex> guard(lock);
+    long ticket = nextTicket++;
+    advanceClock();
+    gauges[queued].current++;
+    gauges[queued].peak = std::max(gauges[queued].peak, gauges[queued].current);
+    jobs[ticket] = std::move(j);
+    encodeQueue.push_back(ticket);
+    if (speculative)
+        speculated++;
+    changed.notify_all();
+    return ticket;
+}
+
+bool runner::trialPipeline::waitEncoded(long ticket, singleRun &sr, std::string &command)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    auto it = jobs.find(ticket);
+    if (it == jobs.end())
+        return false;
+    job &j = *it->second;
+    changed.wait(guard, [&] { return j.state >= encoded; });
+    if (j.state == cancelled)
+        return false;
+    sr = j.sr;
+    command = j.command;
+    return true;
+}
+
+bool runner::trialPipeline::waitScored(long ticket, singleRun &sr, std::string &command)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    auto it = jobs.find(ticket);
+    if (it == jobs.end())
+        return false;
+    job &j = *it->second;
+    changed.wait(guard, [&] { return j.state >= done; });
+    bool scored = j.state == done;
+    if (scored) {
+        sr = j.sr;
+        command = j.command;
+    }
+    jobs.erase(it);
+    return scored;
+}
+
+void runner::trialPipeline::cancel(long ticket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = jobs.find(ticket);
+    if (it == jobs.end() || it->second->state >= done)
+        return;
+    job &j = *it->second;
+    j.cancel = true;
+    cancelledCount++;
+    if (j.speculative)
+        dropped++;
+    if (j.state == encoded || j.state == scoring)
+        wastedCpu += j.sr.netCpuTime;
+    // Running stages notice the flag and finish the job themselves
+    if (j.state == queued) {
+        encodeQueue.erase(std::find(encodeQueue.begin(), encodeQueue.end(), ticket));
+        setState(j, cancelled);
+    } else if (j.state == encoded) {
+        scoreQueue.erase(std::find(scoreQueue.begin(), scoreQueue.end(), ticket));
+        j.packets.clear();
+        setState(j, cancelled);
+    }
+    changed.notify_all();
+}
+
+void runner::trialPipeline::adopt(long ticket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = jobs.find(ticket);
+    if (it != jobs.end() && it->second->speculative)
+        adopted++;
+}
+
+void runner::trialPipeline::encodeWorker()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [&] { return stopping || !encodeQueue.empty(); });
+        if (stopping)
+            return;
+        long ticket = encodeQueue.front();
+        encodeQueue.pop_front();
+        job &j = *jobs.at(ticket);
+        setState(j, encoding);
+        // j.sr is only touched under the lock, so waitEncoded can copy it while the trial is worked on
+        singleRun sr = j.sr;
+        guard.unlock();
+
+        std::vector<encodedPacket> packets;
+        std::string command = encodeTrial(sr, rs, j.ctx, [&] (const uint8_t *data, size_t size, int64_t pts) {
+            encodedPacket p;
+            p.data.assign(data, data + size);
+            p.pts = pts;
+            packets.push_back(p);
+        }, &j.cancel);
+        repeatTiming(sr, rs, j.ctx, &j.cancel);
+
+        guard.lock();
+        j.sr = sr;
+        j.command = command;
+        if (j.cancel) {
+            wastedCpu += j.sr.netCpuTime;
+            setState(j, cancelled);
+        } else {
+            j.packets.swap(packets);
+            setState(j, encoded);
+            scoreQueue.push_back(ticket);
+        }
+        changed.notify_all();
+    }
+}
+
+void runner::trialPipeline::scoreWorker()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [&] { return stopping || !scoreQueue.empty(); });
+        if (stopping)
+            return;
+        long ticket = scoreQueue.front();
+        scoreQueue.pop_front();
+        job &j = *jobs.at(ticket);
+        setState(j, scoring);
+        singleRun sr = j.sr;
+        guard.unlock();
+
+        // cancel only clears the packets of a trial that is not being scored yet
+        scoreStoredTrial(sr, rs, j.ctx, j.packets, rs.vmafSubsample, &j.cancel);
+
+        guard.lock();
+        j.sr = sr;
+        j.packets.clear();
+        setState(j, j.cancel ? cancelled : done);
+        changed.notify_all();
+    }
+}
+
+void runner::trialPipeline::printStats(std::ostream &out)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    advanceClock();
+    double elapsed = std::max(1e-9, std::chrono::duration<double>(lastChange - started).count());
+    out << "Pipeline: encode queue " << gauges[queued].weighted / elapsed << " deep on average (peak " << gauges[queued].peak << "), "
+        << "encoders " << 100 * gauges[encoding].weighted / elapsed / encoders << "% busy; "
+        << "score queue " << gauges[encoded].weighted / elapsed << " deep on average (peak " << gauges[encoded].peak << "), "
+        << "scorers " << 100 * gauges[scoring].weighted / elapsed / scorers << "% busy" << std::endl;
+    if (cancelledCount > 0)
+        out << "Cancelled " << cancelledCount << " trials after " << wastedCpu << "s of cpu time" << std::endl;
+    if (speculated > 0)
+        out << "Speculative encodes: " << speculated << " started, " << adopted << " used, " << dropped << " cancelled" << std::endl;
+}
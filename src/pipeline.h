@@ -0,0 +1,109 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "scheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace runner
+{
+    // Runs trials as two stages. Encoder workers run a trial's passes and keep the packets of its final pass in
+    // memory, and a separate pool of scorers decodes and scores them. A search that only needs encode times can
+    // decide as soon as the encode is done, and the next encode runs while the last one is still being scored.
+    // Trials start encoding in the order they were submitted.
+    class trialPipeline {
+    public:
+        // One encoder worker per scheduler slot
+        trialPipeline(const runSettings &rs, trialScheduler &scheduler, int scorers);
+        ~trialPipeline();
+
+        // speculative marks trials the caller may not need, for the statistics
+        long submit(const singleRun &sr, bool speculative = false);
+        // Waits for the encode; sr gets everything but the vmaf scores. Returns false if the trial was cancelled.
+        bool waitEncoded(long ticket, singleRun &sr, std::string &command);
+        // Waits for the scores as well and forgets the trial. Returns false if it was cancelled.
+        bool waitScored(long ticket, singleRun &sr, std::string &command);
+        // Drops a trial at whatever stage it is in, killing its encoder if it is running
+        void cancel(long ticket);
+        // Counts a speculative trial as used
+        void adopt(long ticket);
+
+        // Time weighted mean and peak depth of both stages' queues, how busy each stage was and what
+        // became of the speculative trials
+        void printStats(std::ostream &out);
+
+    private:
+        enum jobState { queued, encoding, encoded, scoring, done, cancelled };
+
+        struct job {
+            singleRun sr;
+            trialContext ctx;
+            std::string command;
+            std::vector<encodedPacket> packets;
+            jobState state = queued;
+            bool speculative = false;
+            std::atomic<bool> cancel;
+            job() : cancel(false) {}
+        };
+
+        // Depth of one queue or stage over time
+        struct depthGauge {
+            int current = 0;
+            int peak = 0;
+            double weighted = 0;
+        };
+
+        void encodeWorker();
+        void scoreWorker();
+        void setState(job &j, jobState state);
+        void advanceClock();
+
+        runSettings rs;
+        trialScheduler &scheduler;
+        int encoders;
+        int scorers;
+        std::map<long, std::unique_ptr<job>> jobs;
+        std::deque<long> encodeQueue;
+        std::deque<long> scoreQueue;
+        long nextTicket = 0;
+        bool stopping = false;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::vector<std::thread> threads;
+
+        depthGauge gauges[4];
+        std::chrono::steady_clock::time_point started;
+        std::chrono::steady_clock::time_point lastChange;
+        long speculated = 0;
+        long adopted = 0;
+        long dropped = 0;
+        long cancelledCount = 0;
+        double wastedCpu = 0;
+    };
+};
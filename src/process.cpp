@@ -0,0 +1,360 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "process.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+namespace {
+    // Set once by pinCommands before any trial runs
+    cpu_set_t commandCpus;
+    bool commandsPinned = false;
+
+    int reap(pid_t pid, runner::processUsage &usage)
+    {
+        int status = 0;
+        struct rusage ru;
+        pid_t ret;
+        do {
+            ret = wait4(pid, &status, 0, &ru);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            return -1;
+        }
+
+        usage.userMicros = ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec;
+        usage.sysMicros = ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+        usage.maxRssKB = ru.ru_maxrss;
+        usage.voluntarySwitches = ru.ru_nvcsw;
+        usage.involuntarySwitches = ru.ru_nivcsw;
+        usage.minorFaults = ru.ru_minflt;
+        usage.majorFaults = ru.ru_majflt;
+
+        if (WIFEXITED(status))
+            return WEXITSTATUS(status);
+        return -1;
+    }
+
+    // Cpu time of a running child from /proc, in seconds. wait4 only reports it once the child is gone.
+    double liveCpuTime(pid_t pid)
+    {
+        std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+        std::string stat((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        // The command name can contain spaces, the fields after it can not
+        size_t end = stat.rfind(')');
+        if (end == std::string::npos)
+            return 0;
+        std::istringstream fields(stat.substr(end + 2));
+        std::string field;
+        unsigned long long utime = 0, stime = 0;
+        // utime and stime are the 14th and 15th fields, the state after the name is the 3rd
+        for (int i = 3; i <= 15 && fields >> field; i++) {
+            if (i == 14)
+                utime = std::stoull(field);
+            else if (i == 15)
+                stime = std::stoull(field);
+        }
+        return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+    }
+
+    // Follows a running child for a watch. check is called often and returns true once it is time to ask
+    // the watch again; the child is killed the first time the watch says no.
+    class watcher {
+    public:
+        watcher(pid_t pid, const runner::processWatch *watch) : pid(pid), watch(watch), start(std::chrono::steady_clock::now()), last(start) {}
+
+        void check()
+        {
+            if (!watch || stopped)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            if (std::chrono::duration<double>(now - last).count() < watch->interval)
+                return;
+            last = now;
+            if (!watch->keepRunning(liveCpuTime(pid), std::chrono::duration<double>(now - start).count())) {
+                kill(pid, SIGKILL);
+                stopped = true;
+            }
+        }
+
+        bool exited() const
+        {
+            siginfo_t info;
+            info.si_pid = 0;
+            return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0 || info.si_pid == pid;
+        }
+
+        bool stopped = false;
+
+    private:
+        pid_t pid;
+        const runner::processWatch *watch;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point last;
+    };
+
+    // Everything exec needs is built before fork, the child may only make async signal safe calls
+    struct argumentList {
+        std::vector<std::string> args;
+        std::vector<char *> argv;
+
+        argumentList(const std::string &cmd) : args(runner::splitCommand(cmd))
+        {
+            for (size_t i = 0; i < args.size(); i++)
+                argv.push_back(&args.at(i)[0]);
+            argv.push_back(NULL);
+        }
+    };
+
+    // Returns the child's pid, or -1. stdoutFd replaces the child's stdout when it is not -1, and its stderr too with
+    // withStderr. With counters the child waits on a pipe until they are attached, so nothing it execs goes uncounted.
+    pid_t spawn(const argumentList &a, int stdoutFd, runner::perfCounterSet *counters, bool withStderr = false)
+    {
+        if (a.args.empty())
+            return -1;
+        int gate[2] = { -1, -1 };
+        if (counters && pipe2(gate, O_CLOEXEC) != 0)
+            counters = nullptr;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            // dup2 clears close on exec on the new descriptor
+            if (stdoutFd >= 0)
+                dup2(stdoutFd, STDOUT_FILENO);
+            if (stdoutFd >= 0 && withStderr)
+                dup2(stdoutFd, STDERR_FILENO);
+            if (commandsPinned)
+                sched_setaffinity(0, sizeof(commandCpus), &commandCpus);
+            if (counters) {
+                char c;
+                close(gate[1]);
+                while (read(gate[0], &c, 1) < 0 && errno == EINTR) {}
+            }
+            execvp(a.argv[0], a.argv.data());
+            _exit(127);
+        }
+
+        if (counters) {
+            close(gate[0]);
+            if (pid > 0)
+                counters->attach(pid);
+            close(gate[1]);
+        }
+        return pid;
+    }
+}
+
+void runner::processUsage::add(const processUsage &other)
+{
+    userMicros += other.userMicros;
+    sysMicros += other.sysMicros;
+    if (other.maxRssKB > maxRssKB)
+        maxRssKB = other.maxRssKB;
+    voluntarySwitches += other.voluntarySwitches;
+    involuntarySwitches += other.involuntarySwitches;
+    minorFaults += other.minorFaults;
+    majorFaults += other.majorFaults;
+
+    counters.valid = counters.valid || other.counters.valid;
+    counters.cycles += other.counters.cycles;
+    counters.instructions += other.counters.instructions;
+    counters.cacheReferences += other.counters.cacheReferences;
+    counters.cacheMisses += other.counters.cacheMisses;
+    counters.branches += other.counters.branches;
+    counters.branchMisses += other.counters.branchMisses;
+}
+
+std::vector<std::string> runner::splitCommand(const std::string &cmd)
+{
+    std::vector<std::string> args;
+    std::string current;
+    bool inArg = false;
+    char quote = 0;
+    for (size_t i = 0; i < cmd.size(); i++) {
+        char c = cmd[i];
+        if (quote == '\'') {
+            if (c == '\'')
+                quote = 0;
+            else
+                current += c;
+        } else if (quote == '"') {
+            if (c == '"')
+                quote = 0;
+            else if (c == '\\' && i + 1 < cmd.size())
+                current += cmd[++i];
+            else
+                current += c;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            inArg = true;
+        } else if (c == '\\' && i + 1 < cmd.size()) {
+            current += cmd[++i];
+            inArg = true;
+        } else if (c == ' ' || c == '\t' || c == '\n') {
+            if (inArg)
+                args.push_back(current);
+            current.clear();
+            inArg = false;
+        } else {
+            current += c;
+            inArg = true;
+        }
+    }
+    if (inArg)
+        args.push_back(current);
+    return args;
+}
+
+int runner::runCommand(const std::string &cmd, processUsage &usage, bool countEvents, const processWatch *watch)
+{
+    argumentList a(cmd);
+    perfCounterSet counters;
+    pid_t pid = spawn(a, -1, countEvents ? &counters : nullptr);
+    if (pid < 0) {
+        return -1;
+    }
+    watcher w(pid, watch);
+    if (watch) {
+        // Polls for the exit without reaping, so reap still gets the child's rusage
+        while (!w.exited() && !w.stopped) {
+            usleep(20000);
+            w.check();
+        }
+    }
+    int status = reap(pid, usage);
+    usage.counters = counters.read();
+    return w.stopped ? commandStopped : status;
+}
+
+int runner::runCommand(const std::string &cmd, processUsage &usage, const std::function<void(const uint8_t *, size_t)> &onOutput,
+                       bool countEvents, const processWatch *watch)
+{
+    argumentList a(cmd);
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+
+    perfCounterSet counters;
+    pid_t pid = spawn(a, fds[1], countEvents ? &counters : nullptr);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    uint8_t buffer[65536];
+    watcher w(pid, watch);
+    while (true) {
+        if (watch) {
+            // Wakes up now and then even when the child is quiet, so a watch is still asked
+            struct pollfd p;
+            p.fd = fds[0];
+            p.events = POLLIN;
+            int ready = poll(&p, 1, 50);
+            w.check();
+            if (ready == 0 || (ready < 0 && errno == EINTR))
+                continue;
+        }
+        ssize_t n = read(fds[0], buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        onOutput(buffer, (size_t) n);
+    }
+    close(fds[0]);
+    int status = reap(pid, usage);
+    usage.counters = counters.read();
+    return w.stopped ? commandStopped : status;
+}
+
+std::string runner::commandOutput(const std::string &cmd)
+{
+    argumentList a(cmd);
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return "";
+    }
+
+    pid_t pid = spawn(a, fds[1], nullptr, true);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return "";
+    }
+
+    std::string output;
+    char buffer[4096];
+    while (true) {
+        ssize_t n = read(fds[0], buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        output.append(buffer, (size_t) n);
+    }
+    close(fds[0]);
+    processUsage usage;
+    reap(pid, usage);
+    return output;
+}
+
+bool runner::pinCommands(const std::string &list, std::vector<int> &cpus)
+{
+    cpus.clear();
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first, last;
+        char dash;
+        std::stringstream r(range);
+        if (!(r >> first))
+            return false;
+        last = first;
+        if (r >> dash && (dash != '-' || !(r >> last)))
+            return false;
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (int c = first; c <= last; c++)
+            cpus.push_back(c);
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    if (cpus.empty())
+        return false;
+
+    CPU_ZERO(&commandCpus);
+    for (size_t i = 0; i < cpus.size(); i++)
+        CPU_SET(cpus.at(i), &commandCpus);
+    commandsPinned = true;
+    return true;
+}
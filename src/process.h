@@ -0,0 +1,81 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "perfcounters.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Resource usage of one child process as reported by wait4
+    struct processUsage {
+        long long userMicros = 0;
+        long long sysMicros = 0;
+        long maxRssKB = 0;
+        long voluntarySwitches = 0;
+        long involuntarySwitches = 0;
+        long minorFaults = 0;
+        long majorFaults = 0;
+        // Only filled in when the command was run with countEvents
+        perfCounts counters;
+
+        double userTime() const { return userMicros / 1000000.0; }
+        double sysTime() const { return sysMicros / 1000000.0; }
+        double cpuTime() const { return (userMicros + sysMicros) / 1000000.0; }
+
+        // Adds the counters of a later process; peak rss is the larger of the two
+        void add(const processUsage &other);
+    };
+
+    // Lets the caller follow a command while it runs. keepRunning is called about every interval seconds with the
+    // cpu time the child has used so far and the real time since it started; returning false kills the child.
+    struct processWatch {
+        double interval = 0.5;
+        std::function<bool(double cpuSeconds, double realSeconds)> keepRunning;
+    };
+
+    // Returned by runCommand when a watch stopped the command. Usage still covers what it ran.
+    const int commandStopped = -2;
+
+    // Pins every command run from now on to the cpus in list, such as "2-3,6", and returns them in cpus.
+    // Returns false if the list is empty or malformed, in which case nothing is pinned.
+    bool pinCommands(const std::string &list, std::vector<int> &cpus);
+
+    // Splits a command line into arguments, honouring single quotes, double quotes and backslashes
+    std::vector<std::string> splitCommand(const std::string &cmd);
+
+    // Runs cmd with fork and exec (no shell) and reaps it with wait4, so usage covers exactly this child.
+    // This stays correct when several trials are running at once.
+    // With countEvents, hardware counters are attached to the child before it execs.
+    // Returns the exit status of the command, commandStopped if watch stopped it, or -1 if it could not be run or was killed.
+    int runCommand(const std::string &cmd, processUsage &usage, bool countEvents = false, const processWatch *watch = nullptr);
+
+    // Same as above, but the command's stdout is read through a pipe and handed to onOutput as it arrives.
+    // A watch is called from the same thread as onOutput.
+    int runCommand(const std::string &cmd, processUsage &usage, const std::function<void(const uint8_t *, size_t)> &onOutput,
+                   bool countEvents = false, const processWatch *watch = nullptr);
+
+    // Runs cmd to completion and returns everything it wrote to stdout and stderr, or an empty string if it could not be run.
+    // Meant for short probes such as asking a program for its version, which some programs print to stderr.
+    std::string commandOutput(const std::string &cmd);
+};
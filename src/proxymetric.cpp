@@ -0,0 +1,379 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "proxymetric.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCV_X86_KERNELS 1
+#endif
+
+namespace {
+    // Sums of squared differences over a row, and the five sums SSIM needs over an 8x8 window
+    typedef uint64_t (*rowSseFn)(const uint8_t *ref, const uint8_t *dist, int samples);
+    typedef void (*windowSumsFn)(const uint8_t *ref, int refStride, const uint8_t *dist, int distStride, int64_t sums[5]);
+
+    struct kernelSet {
+        const char *name;
+        rowSseFn rowSse8;
+        rowSseFn rowSse16;
+        windowSumsFn window8;
+        windowSumsFn window16;
+    };
+
+    template <typename S>
+    uint64_t rowSseScalar(const uint8_t *ref, const uint8_t *dist, int samples)
+    {
+        const S *r = (const S *) ref;
+        const S *d = (const S *) dist;
+        uint64_t sum = 0;
+        for (int x = 0; x < samples; x++) {
+            int64_t diff = (int64_t) r[x] - d[x];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+
+    template <typename S>
+    void windowScalar(const uint8_t *ref, int refStride, const uint8_t *dist, int distStride, int64_t sums[5])
+    {
+        int64_t sr = 0, sd = 0, srr = 0, sdd = 0, srd = 0;
+        for (int y = 0; y < 8; y++) {
+            const S *r = (const S *) (ref + y * refStride);
+            const S *d = (const S *) (dist + y * distStride);
+            for (int x = 0; x < 8; x++) {
+                sr += r[x];
+                sd += d[x];
+                srr += r[x] * r[x];
+                sdd += d[x] * d[x];
+                srd += r[x] * d[x];
+            }
+        }
+        sums[0] = sr;
+        sums[1] = sd;
+        sums[2] = srr;
+        sums[3] = sdd;
+        sums[4] = srd;
+    }
+
+#ifdef SCV_X86_KERNELS
+    // Samples of up to 12 bits fit in signed 16 bit lanes, so both depths share the madd based kernels below
+    // once loaded. A lane of squared differences grows by at most 2 * 4095^2 per step, so the 32 bit
+    // accumulators are widened every 32 steps.
+    struct sse41Load8 {
+        static __attribute__((target("sse4.1"))) __m128i load(const uint8_t *p) { return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) p)); }
+        static const int size = 1;
+    };
+    struct sse41Load16 {
+        static __attribute__((target("sse4.1"))) __m128i load(const uint8_t *p) { return _mm_loadu_si128((const __m128i *) p); }
+        static const int size = 2;
+    };
+    struct avx2Load8 {
+        static __attribute__((target("avx2"))) __m256i load(const uint8_t *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) p)); }
+        // Two rows of 8 samples in one register
+        static __attribute__((target("avx2"))) __m256i loadRows(const uint8_t *a, const uint8_t *b)
+        {
+            return _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) a), _mm_loadl_epi64((const __m128i *) b)));
+        }
+        static const int size = 1;
+    };
+    struct avx2Load16 {
+        static __attribute__((target("avx2"))) __m256i load(const uint8_t *p) { return _mm256_loadu_si256((const __m256i *) p); }
+        static __attribute__((target("avx2"))) __m256i loadRows(const uint8_t *a, const uint8_t *b)
+        {
+            return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) a)), _mm_loadu_si128((const __m128i *) b), 1);
+        }
+        static const int size = 2;
+    };
+
+    __attribute__((target("sse4.1"))) int64_t sumEpi32(__m128i v)
+    {
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(v);
+    }
+
+    __attribute__((target("sse4.1"))) uint64_t sumEpi64(__m128i v)
+    {
+        return (uint64_t) _mm_cvtsi128_si64(v) + (uint64_t) _mm_extract_epi64(v, 1);
+    }
+
+    template <typename L>
+    __attribute__((target("sse4.1"))) uint64_t rowSseSse41(const uint8_t *ref, const uint8_t *dist, int samples)
+    {
+        __m128i wide = _mm_setzero_si128();
+        int x = 0;
+        while (x + 8 <= samples) {
+            __m128i acc = _mm_setzero_si128();
+            for (int step = 0; step < 32 && x + 8 <= samples; step++, x += 8) {
+                __m128i diff = _mm_sub_epi16(L::load(ref + x * L::size), L::load(dist + x * L::size));
+                acc = _mm_add_epi32(acc, _mm_madd_epi16(diff, diff));
+            }
+            wide = _mm_add_epi64(wide, _mm_cvtepu32_epi64(acc));
+            wide = _mm_add_epi64(wide, _mm_cvtepu32_epi64(_mm_srli_si128(acc, 8)));
+        }
+        uint64_t sum = sumEpi64(wide);
+        if (L::size == 1)
+            sum += rowSseScalar<uint8_t>(ref + x, dist + x, samples - x);
+        else
+            sum += rowSseScalar<uint16_t>(ref + 2 * x, dist + 2 * x, samples - x);
+        return sum;
+    }
+
+    template <typename L>
+    __attribute__((target("sse4.1"))) void windowSse41(const uint8_t *ref, int refStride, const uint8_t *dist, int distStride, int64_t sums[5])
+    {
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i sr = _mm_setzero_si128(), sd = sr, srr = sr, sdd = sr, srd = sr;
+        for (int y = 0; y < 8; y++) {
+            __m128i r = L::load(ref + y * refStride);
+            __m128i d = L::load(dist + y * distStride);
+            sr = _mm_add_epi32(sr, _mm_madd_epi16(r, ones));
+            sd = _mm_add_epi32(sd, _mm_madd_epi16(d, ones));
+            srr = _mm_add_epi32(srr, _mm_madd_epi16(r, r));
+            sdd = _mm_add_epi32(sdd, _mm_madd_epi16(d, d));
+            srd = _mm_add_epi32(srd, _mm_madd_epi16(r, d));
+        }
+        sums[0] = sumEpi32(sr);
+        sums[1] = sumEpi32(sd);
+        sums[2] = sumEpi32(srr);
+        sums[3] = sumEpi32(sdd);
+        sums[4] = sumEpi32(srd);
+    }
+
+    __attribute__((target("avx2"))) int64_t sumEpi32(__m256i v)
+    {
+        return sumEpi32(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+    }
+
+    template <typename L>
+    __attribute__((target("avx2"))) uint64_t rowSseAvx2(const uint8_t *ref, const uint8_t *dist, int samples)
+    {
+        __m256i wide = _mm256_setzero_si256();
+        int x = 0;
+        while (x + 16 <= samples) {
+            __m256i acc = _mm256_setzero_si256();
+            for (int step = 0; step < 32 && x + 16 <= samples; step++, x += 16) {
+                __m256i diff = _mm256_sub_epi16(L::load(ref + x * L::size), L::load(dist + x * L::size));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(diff, diff));
+            }
+            wide = _mm256_add_epi64(wide, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(acc)));
+            wide = _mm256_add_epi64(wide, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(acc, 1)));
+        }
+        uint64_t sum = sumEpi64(_mm_add_epi64(_mm256_castsi256_si128(wide), _mm256_extracti128_si256(wide, 1)));
+        if (L::size == 1)
+            sum += rowSseScalar<uint8_t>(ref + x, dist + x, samples - x);
+        else
+            sum += rowSseScalar<uint16_t>(ref + 2 * x, dist + 2 * x, samples - x);
+        return sum;
+    }
+
+    template <typename L>
+    __attribute__((target("avx2"))) void windowAvx2(const uint8_t *ref, int refStride, const uint8_t *dist, int distStride, int64_t sums[5])
+    {
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i sr = _mm256_setzero_si256(), sd = sr, srr = sr, sdd = sr, srd = sr;
+        for (int y = 0; y < 8; y += 2) {
+            __m256i r = L::loadRows(ref + y * refStride, ref + (y + 1) * refStride);
+            __m256i d = L::loadRows(dist + y * distStride, dist + (y + 1) * distStride);
+            sr = _mm256_add_epi32(sr, _mm256_madd_epi16(r, ones));
+            sd = _mm256_add_epi32(sd, _mm256_madd_epi16(d, ones));
+            srr = _mm256_add_epi32(srr, _mm256_madd_epi16(r, r));
+            sdd = _mm256_add_epi32(sdd, _mm256_madd_epi16(d, d));
+            srd = _mm256_add_epi32(srd, _mm256_madd_epi16(r, d));
+        }
+        sums[0] = sumEpi32(sr);
+        sums[1] = sumEpi32(sd);
+        sums[2] = sumEpi32(srr);
+        sums[3] = sumEpi32(sdd);
+        sums[4] = sumEpi32(srd);
+    }
+#endif
+
+    kernelSet pickKernels()
+    {
+#ifdef SCV_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return {"avx2", rowSseAvx2<avx2Load8>, rowSseAvx2<avx2Load16>, windowAvx2<avx2Load8>, windowAvx2<avx2Load16>};
+        if (__builtin_cpu_supports("sse4.1"))
+            return {"sse4.1", rowSseSse41<sse41Load8>, rowSseSse41<sse41Load16>, windowSse41<sse41Load8>, windowSse41<sse41Load16>};
+#endif
+        return {"scalar", rowSseScalar<uint8_t>, rowSseScalar<uint16_t>, windowScalar<uint8_t>, windowScalar<uint16_t>};
+    }
+
+    const kernelSet &kernels()
+    {
+        static const kernelSet chosen = pickKernels();
+        return chosen;
+    }
+
+    double psnrFromMse(double mse, int bits)
+    {
+        double peak = (double) ((1 << bits) - 1);
+        if (mse <= 0)
+            return 100;
+        return std::min(100.0, 10 * std::log10(peak * peak / mse));
+    }
+
+    double ssimDb(double ssim)
+    {
+        return -10 * std::log10(std::max(1e-10, 1 - ssim));
+    }
+}
+
+runner::proxyScorer::proxyScorer(int width, int height, int bits) :
+    width(width), height(height), bits(bits)
+{
+}
+
+void runner::proxyScorer::addFrame(const uint8_t *const ref[3], const int refStride[3], int refBits,
+                                   const uint8_t *const dist[3], const int distStride[3], int distBits)
+{
+    if (refBits != distBits || refBits > 12)
+        usable = false;
+    if (!usable)
+        return;
+
+    const kernelSet &k = kernels();
+    bool wide = refBits > 8;
+    int bytes = wide ? 2 : 1;
+    for (int p = 0; p < 3; p++) {
+        int w = p == 0 ? width : (width + 1) / 2;
+        int h = p == 0 ? height : (height + 1) / 2;
+        for (int y = 0; y < h; y++)
+            sse[p] += (wide ? k.rowSse16 : k.rowSse8)(ref[p] + y * refStride[p], dist[p] + y * distStride[p], w);
+    }
+
+    // Luma SSIM with the usual constants for the sample range, over 8x8 windows that overlap by half
+    double peak = (double) ((1 << refBits) - 1);
+    double c1 = (0.01 * peak) * (0.01 * peak) * 64 * 64;
+    double c2 = (0.03 * peak) * (0.03 * peak) * 64 * 64;
+    int64_t sums[5];
+    for (int y = 0; y + 8 <= height; y += 4) {
+        for (int x = 0; x + 8 <= width; x += 4) {
+            (wide ? k.window16 : k.window8)(ref[0] + y * refStride[0] + x * bytes, refStride[0],
+                                            dist[0] + y * distStride[0] + x * bytes, distStride[0], sums);
+            double sr = (double) sums[0], sd = (double) sums[1];
+            double varSum = 64.0 * (sums[2] + sums[3]) - sr * sr - sd * sd;
+            double cov = 64.0 * sums[4] - sr * sd;
+            ssimSum += ((2 * sr * sd + c1) * (2 * cov + c2)) / ((sr * sr + sd * sd + c1) * (varSum + c2));
+            ssimWindows++;
+        }
+    }
+    frameCount++;
+}
+
+runner::proxyResult runner::proxyScorer::finish() const
+{
+    proxyResult result;
+    if (!usable || frameCount == 0)
+        return result;
+
+    double chromaSamples = (double) ((width + 1) / 2) * ((height + 1) / 2) * frameCount;
+    double lumaSamples = (double) width * height * frameCount;
+    result.psnr = (6 * psnrFromMse(sse[0] / lumaSamples, bits) + psnrFromMse(sse[1] / chromaSamples, bits) +
+                   psnrFromMse(sse[2] / chromaSamples, bits)) / 8;
+    result.ssim = ssimWindows > 0 ? ssimSum / ssimWindows : 0;
+    return result;
+}
+
+const char *runner::proxyKernelName()
+{
+    return kernels().name;
+}
+
+void runner::proxyCalibration::add(const proxyResult &proxy, double vmaf)
+{
+    sample s;
+    s.psnr = proxy.psnr;
+    s.ssimDb = ssimDb(proxy.ssim);
+    s.vmaf = vmaf;
+    samples.push_back(s);
+}
+
+runner::proxyCalibration::line runner::proxyCalibration::fit(bool useSsim) const
+{
+    line l;
+    size_t n = samples.size();
+    if (n < 2)
+        return l;
+    double mx = 0, my = 0;
+    for (size_t i = 0; i < n; i++) {
+        mx += useSsim ? samples.at(i).ssimDb : samples.at(i).psnr;
+        my += samples.at(i).vmaf;
+    }
+    mx /= n;
+    my /= n;
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dx = (useSsim ? samples.at(i).ssimDb : samples.at(i).psnr) - mx;
+        sxx += dx * dx;
+        sxy += dx * (samples.at(i).vmaf - my);
+    }
+    if (sxx < 1e-6)
+        return l;
+    l.slope = sxy / sxx;
+    l.offset = my - l.slope * mx;
+    for (size_t i = 0; i < n; i++) {
+        double x = useSsim ? samples.at(i).ssimDb : samples.at(i).psnr;
+        double e = samples.at(i).vmaf - (l.offset + l.slope * x);
+        l.residual += e * e;
+    }
+    l.valid = true;
+    return l;
+}
+
+runner::proxyCalibration::line runner::proxyCalibration::best(bool &useSsim) const
+{
+    line psnrLine = fit(false);
+    useSsim = false;
+    // Two points fit either line exactly, so only choose between them once there is a third
+    if (samples.size() < 3)
+        return psnrLine;
+    line ssimLine = fit(true);
+    if (ssimLine.valid && (!psnrLine.valid || ssimLine.residual < psnrLine.residual)) {
+        useSsim = true;
+        return ssimLine;
+    }
+    return psnrLine;
+}
+
+bool runner::proxyCalibration::ready() const
+{
+    return fit(false).valid;
+}
+
+double runner::proxyCalibration::predict(const proxyResult &proxy) const
+{
+    bool useSsim;
+    line l = best(useSsim);
+    double x = useSsim ? ssimDb(proxy.ssim) : proxy.psnr;
+    return std::max(0.0, std::min(100.0, l.offset + l.slope * x));
+}
+
+std::string runner::proxyCalibration::describe() const
+{
+    bool useSsim;
+    line l = best(useSsim);
+    std::ostringstream out;
+    out << "vmaf = " << l.offset << " + " << l.slope << " * " << (useSsim ? "SSIM dB" : "PSNR") << " from " << samples.size() << " trials";
+    return out.str();
+}
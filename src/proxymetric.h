@@ -0,0 +1,91 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    struct proxyResult {
+        // Mean squared error pooled over the trial, luma and chroma weighted 6:1:1
+        double psnr = 0;
+        // Mean luma SSIM over 8x8 windows on a 4 sample grid
+        double ssim = 0;
+    };
+
+    // PSNR and SSIM computed in process with SSE4.1 or AVX2 kernels when the cpu has them.
+    // Frames are planar yuv420 at the test resolution; samples wider than 8 bits are stored in 16 bit words.
+    class proxyScorer {
+    public:
+        proxyScorer(int width, int height, int bits);
+
+        // False once frames of differing bit depths were added, which the kernels do not convert
+        bool good() const { return usable; }
+
+        void addFrame(const uint8_t *const ref[3], const int refStride[3], int refBits,
+                      const uint8_t *const dist[3], const int distStride[3], int distBits);
+
+        proxyResult finish() const;
+
+    private:
+        int width;
+        int height;
+        int bits;
+        uint64_t sse[3] = {0, 0, 0};
+        double ssimSum = 0;
+        long ssimWindows = 0;
+        long frameCount = 0;
+        bool usable = true;
+    };
+
+    // Name of the kernels proxyScorer picked for this cpu
+    const char *proxyKernelName();
+
+    // Maps the proxy metrics of a session onto VMAF with a straight line fitted to trials that were scored with both.
+    // With three or more of them it uses whichever of PSNR and SSIM (in dB) fits better.
+    class proxyCalibration {
+    public:
+        void add(const proxyResult &proxy, double vmaf);
+
+        // At least two trials with different PSNR
+        bool ready() const;
+        double predict(const proxyResult &proxy) const;
+        size_t points() const { return samples.size(); }
+        std::string describe() const;
+
+    private:
+        struct sample {
+            double psnr;
+            double ssimDb;
+            double vmaf;
+        };
+        struct line {
+            double offset = 0;
+            double slope = 0;
+            double residual = 0;
+            bool valid = false;
+        };
+        line fit(bool useSsim) const;
+        line best(bool &useSsim) const;
+
+        std::vector<sample> samples;
+    };
+};
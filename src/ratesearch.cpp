@@ -0,0 +1,156 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ratesearch.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+    // vmaf points gained per doubling of the bitrate, only used until there is data to fit
+    const double defaultVmafPerDoubling = 8.0;
+    // Never move more than this factor away from the closest probe in one step
+    const double maxStepFactor = 4.0;
+
+    struct probe {
+        double logRate;
+        double vmaf;
+    };
+
+    // Least squares slope of vmaf against log(bitrate) within each group of settings, pooled over all groups
+    double pooledSlope(const std::vector<runner::singleRun> &runsList)
+    {
+        std::vector<runner::paramPoint> settings;
+        for (size_t i = 0; i < runsList.size(); i++) {
+            if (std::find(settings.begin(), settings.end(), runsList.at(i).params) == settings.end())
+                settings.push_back(runsList.at(i).params);
+        }
+        double sxy = 0, sxx = 0;
+        for (size_t s = 0; s < settings.size(); s++) {
+            double mx = 0, my = 0;
+            int n = 0;
+            for (size_t i = 0; i < runsList.size(); i++) {
+                if (runsList.at(i).params == settings.at(s) && runsList.at(i).bitrate > 0 && !runsList.at(i).tooSlow) {
+                    mx += std::log(runsList.at(i).bitrate);
+                    my += runsList.at(i).vmaf;
+                    n++;
+                }
+            }
+            if (n < 2)
+                continue;
+            mx /= n;
+            my /= n;
+            for (size_t i = 0; i < runsList.size(); i++) {
+                if (runsList.at(i).params == settings.at(s) && runsList.at(i).bitrate > 0 && !runsList.at(i).tooSlow) {
+                    double dx = std::log(runsList.at(i).bitrate) - mx;
+                    sxy += dx * (runsList.at(i).vmaf - my);
+                    sxx += dx * dx;
+                }
+            }
+        }
+        if (sxx <= 0 || sxy <= 0)
+            return defaultVmafPerDoubling / std::log(2.0);
+        return sxy / sxx;
+    }
+
+    double clampStep(double logRate, double from)
+    {
+        double maxStep = std::log(maxStepFactor);
+        return std::max(from - maxStep, std::min(from + maxStep, logRate));
+    }
+}
+
+double runner::bisectionSearch::nextBitrate(const std::vector<singleRun> &runsList, double target, long passNum, const paramPoint &params, double defaultBR)
+{
+    // getNextTestBitrate only looks at the pass number, and a frontier pass probes many settings under one
+    std::vector<singleRun> own;
+    for (size_t i = 0; i < runsList.size(); i++) {
+        if (runsList.at(i).params == params)
+            own.push_back(runsList.at(i));
+    }
+    return getNextTestBitrate(own, target, passNum, defaultBR);
+}
+
+double runner::secantSearch::nextBitrate(const std::vector<singleRun> &runsList, double target, long passNum, const paramPoint &params, double defaultBR)
+{
+    std::vector<probe> probes;
+    for (size_t i = 0; i < runsList.size(); i++) {
+        const singleRun &r = runsList.at(i);
+        // Proxy estimates are only good enough for the rough search they were made for
+        if (r.params == params && r.bitrate > 0 && !r.tooSlow && (!r.proxyScored || passNum == r.optimizationPassNumber)) {
+            probe p;
+            p.logRate = std::log(r.bitrate);
+            p.vmaf = r.vmaf;
+            probes.push_back(p);
+        }
+    }
+    if (probes.empty())
+        return defaultBR;
+
+    int low = -1, high = -1, closest = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+        double diff = probes.at(i).vmaf - target;
+        if (diff <= 0 && (low < 0 || diff > probes.at(low).vmaf - target))
+            low = i;
+        if (diff > 0 && (high < 0 || diff < probes.at(high).vmaf - target))
+            high = i;
+        if (std::abs(diff) < std::abs(probes.at(closest).vmaf - target))
+            closest = i;
+    }
+
+    // Bracketed: interpolate in log(bitrate), but stay slightly away from the ends so a badly curved
+    // segment still shrinks every step
+    if (low >= 0 && high >= 0 && probes.at(high).vmaf > probes.at(low).vmaf) {
+        const probe &l = probes.at(low);
+        const probe &h = probes.at(high);
+        double t = (target - l.vmaf) / (h.vmaf - l.vmaf);
+        t = std::max(0.05, std::min(0.95, t));
+        return std::exp(l.logRate + t * (h.logRate - l.logRate));
+    }
+
+    // Not bracketed yet: extrapolate along a monotone fit of all the probes at these settings
+    double slope = pooledSlope(runsList);
+    if (probes.size() >= 2) {
+        double mx = 0, my = 0;
+        for (size_t i = 0; i < probes.size(); i++) {
+            mx += probes.at(i).logRate;
+            my += probes.at(i).vmaf;
+        }
+        mx /= probes.size();
+        my /= probes.size();
+        double sxy = 0, sxx = 0;
+        for (size_t i = 0; i < probes.size(); i++) {
+            sxy += (probes.at(i).logRate - mx) * (probes.at(i).vmaf - my);
+            sxx += (probes.at(i).logRate - mx) * (probes.at(i).logRate - mx);
+        }
+        if (sxx > 0 && sxy > 0)
+            slope = sxy / sxx;
+    }
+    const probe &c = probes.at(closest);
+    double next = c.logRate + (target - c.vmaf) / slope;
+    return std::exp(clampStep(next, c.logRate));
+}
+
+std::unique_ptr<runner::rateSearch> runner::makeRateSearch(const std::string &name)
+{
+    if (name == "bisect")
+        return std::unique_ptr<rateSearch>(new bisectionSearch());
+    if (name == "secant")
+        return std::unique_ptr<rateSearch>(new secantSearch());
+    return std::unique_ptr<rateSearch>();
+}
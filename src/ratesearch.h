@@ -0,0 +1,56 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Picks the next bitrate to try when searching for the bitrate that gives a vmaf target.
+    class rateSearch {
+    public:
+        virtual ~rateSearch() {}
+
+        // passNum and params identify the probes that belong to this search; defaultBR is the first guess.
+        virtual double nextBitrate(const std::vector<singleRun> &runsList, double target, long passNum, const paramPoint &params, double defaultBR) = 0;
+        virtual const char *name() const = 0;
+    };
+
+    // Doubles or halves until the target is bracketed, then takes the midpoint of the closest probes
+    class bisectionSearch : public rateSearch {
+    public:
+        double nextBitrate(const std::vector<singleRun> &runsList, double target, long passNum, const paramPoint &params, double defaultBR);
+        const char *name() const { return "bisect"; }
+    };
+
+    // Treats vmaf as roughly linear in log(bitrate). Interpolates between the probes that bracket the target,
+    // and extrapolates along a least squares fit of every probe at the same settings until it is bracketed.
+    // Before there are two probes the slope is borrowed from probes at other settings, such as pass 1.
+    class secantSearch : public rateSearch {
+    public:
+        double nextBitrate(const std::vector<singleRun> &runsList, double target, long passNum, const paramPoint &params, double defaultBR);
+        const char *name() const { return "secant"; }
+    };
+
+    // Returns nullptr for an unknown name
+    std::unique_ptr<rateSearch> makeRateSearch(const std::string &name);
+};
@@ -0,0 +1,217 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "refcache.h"
+#include "runner.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const uint64_t hashSeed = 0xcbf29ce484222325ULL;
+    const uint64_t hashPrime = 0x100000001b3ULL;
+    const char *metaMagic = "scv-reference";
+    const int sampledBlocks = 256;
+    const size_t sampleSize = 65536;
+
+    // Hashes whole words at a time so hashing a large source stays close to disk speed.
+    // This only has to tell inputs apart, it is not meant to be cryptographically strong.
+    uint64_t hashBytes(uint64_t h, const uint8_t *data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            h = (h ^ word) * hashPrime;
+            h ^= h >> 29;
+        }
+        for (; i < size; i++) {
+            h = (h ^ data[i]) * hashPrime;
+        }
+        return h;
+    }
+
+    uint64_t sampledChecksum(const std::string &path, long long size)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return 0;
+        std::vector<uint8_t> block(sampleSize);
+        uint64_t h = hashBytes(hashSeed, (const uint8_t *) &size, sizeof(size));
+        for (int i = 0; i < sampledBlocks; i++) {
+            long long offset = size > (long long) sampleSize ? (size - sampleSize) / (sampledBlocks - 1) * i : 0;
+            ssize_t n = pread(fd, block.data(), sampleSize, offset);
+            if (n <= 0)
+                break;
+            h = hashBytes(h, block.data(), n);
+        }
+        close(fd);
+        return h;
+    }
+}
+
+runner::referenceCache::referenceCache(const std::string &directory, long long budgetBytes) :
+    directory(directory), budget(budgetBytes)
+{
+    if (enabled())
+        _mkdir(this->directory.c_str());
+}
+
+std::string runner::referenceCache::key(const std::string &inputFile, int width, int height, int bits)
+{
+    std::ifstream in(inputFile, std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    uint64_t h = hashSeed;
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        h = hashBytes(h, (const uint8_t *) buffer.data(), in.gcount());
+    }
+    std::stringstream k;
+    k << std::hex << h << std::dec << "-" << width << "x" << height << "-" << bits;
+    return k.str();
+}
+
+std::string runner::referenceCache::entryPath(const std::string &key) const
+{
+    return directory + "/" + key + ".yuv";
+}
+
+std::string runner::referenceCache::metaPath(const std::string &key) const
+{
+    return directory + "/" + key + ".meta";
+}
+
+bool runner::referenceCache::copyFile(const std::string &from, const std::string &to)
+{
+    std::ifstream in(from, std::ios::binary);
+    std::ofstream out(to, std::ios::binary | std::ios::trunc);
+    if (!in || !out)
+        return false;
+    std::vector<char> buffer(1 << 20);
+    while (in) {
+        in.read(buffer.data(), buffer.size());
+        out.write(buffer.data(), in.gcount());
+    }
+    out.close();
+    if (!in.eof() || !out) {
+        remove(to.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::string runner::referenceCache::lookup(const std::string &key, size_t frameBytes)
+{
+    if (!enabled())
+        return "";
+
+    std::ifstream meta(metaPath(key));
+    std::string magic;
+    long long size = 0;
+    size_t storedFrameBytes = 0;
+    uint64_t checksum = 0;
+    if (!(meta >> magic >> size >> storedFrameBytes >> checksum) || magic != metaMagic)
+        return "";
+
+    std::string path = entryPath(key);
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_size != size || storedFrameBytes != frameBytes ||
+            size % frameBytes != 0 || sampledChecksum(path, size) != checksum) {
+        std::cout << "Cached reference " << path << " failed its integrity check, preparing it again" << std::endl;
+        remove(path.c_str());
+        remove(metaPath(key).c_str());
+        return "";
+    }
+
+    // The metadata file's modification time is the entry's last use
+    utimensat(AT_FDCWD, metaPath(key).c_str(), NULL, 0);
+    return path;
+}
+
+bool runner::referenceCache::commit(const std::string &key, const frameStore &store)
+{
+    // A hard link costs nothing when the store is on the same filesystem, otherwise the data is copied.
+    // Either way it lands next to the entry first, so lookup never sees half of it.
+    std::string pending = entryPath(key) + "." + std::to_string(getpid()) + ".tmp";
+    if (link(store.path().c_str(), pending.c_str()) != 0 && !copyFile(store.path(), pending))
+        return false;
+
+    // The metadata goes first, an entry without its data file is simply dropped by lookup
+    long long size = (long long) store.frames() * store.frameSize();
+    std::ofstream meta(metaPath(key));
+    meta << metaMagic << " " << size << " " << store.frameSize() << " " << sampledChecksum(pending, size) << std::endl;
+    meta.close();
+    if (!meta.good() || ::rename(pending.c_str(), entryPath(key).c_str()) != 0) {
+        remove(pending.c_str());
+        remove(metaPath(key).c_str());
+        return false;
+    }
+
+    evict(key);
+    return true;
+}
+
+void runner::referenceCache::evict(const std::string &keep)
+{
+    struct entry {
+        std::string key;
+        long long size;
+        time_t lastUse;
+    };
+    std::vector<entry> entries;
+    long long total = 0;
+
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        std::string name = d->d_name;
+        if (name.size() <= 5 || name.compare(name.size() - 5, 5, ".meta") != 0)
+            continue;
+        entry e;
+        e.key = name.substr(0, name.size() - 5);
+        struct stat data, meta;
+        if (stat(entryPath(e.key).c_str(), &data) != 0 || stat(metaPath(e.key).c_str(), &meta) != 0)
+            continue;
+        e.size = data.st_size;
+        e.lastUse = meta.st_mtime;
+        total += e.size;
+        entries.push_back(e);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(), [] (const entry &a, const entry &b) { return a.lastUse < b.lastUse; });
+    for (size_t i = 0; i < entries.size() && total > budget; i++) {
+        if (entries.at(i).key == keep)
+            continue;
+        std::cout << "Evicting cached reference " << entries.at(i).key << std::endl;
+        remove(metaPath(entries.at(i).key).c_str());
+        remove(entryPath(entries.at(i).key).c_str());
+        total -= entries.at(i).size;
+    }
+}
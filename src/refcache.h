@@ -0,0 +1,57 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "framestore.h"
+#include <stdint.h>
+#include <string>
+
+namespace runner
+{
+    // Prepared references kept between sessions, addressed by a hash of the input file's contents
+    // plus the test resolution and bit depth. Every entry has a small metadata file holding its size
+    // and a checksum of sampled blocks, which is checked before the entry is used. Entries are evicted
+    // least recently used first once the cache is over its size budget.
+    class referenceCache {
+    public:
+        // An empty directory disables the cache
+        referenceCache(const std::string &directory, long long budgetBytes);
+
+        bool enabled() const { return budget > 0 && !directory.empty(); }
+        bool fits(long long bytes) const { return bytes <= budget; }
+
+        static std::string key(const std::string &inputFile, int width, int height, int bits);
+
+        // Returns the path of a verified entry, or an empty string
+        std::string lookup(const std::string &key, size_t frameBytes);
+
+        // Adds a finished store to the cache, which keeps its own copy, and evicts older entries to stay within the budget
+        bool commit(const std::string &key, const frameStore &store);
+
+        static bool copyFile(const std::string &from, const std::string &to);
+
+    private:
+        std::string entryPath(const std::string &key) const;
+        std::string metaPath(const std::string &key) const;
+        void evict(const std::string &keep);
+
+        std::string directory;
+        long long budget;
+    };
+};
@@ -0,0 +1,445 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultstore.h"
+#include "encoders.h"
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <math.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    const char recordMagic[4] = {'S', 'C', 'V', 'R'};
+    // Version 2 added the coarse search fields at the end, version 1 records are still read
+    const uint32_t recordVersion = 2;
+    const size_t frameSize = 4 + 4 + 4 + 8;
+    // Records further than this from the current session are not similar enough to learn from
+    const double maxDistance = 0.6;
+    const size_t rateNeighbours = 4;
+
+    uint64_t checksum(const char *data, size_t size)
+    {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (size_t i = 0; i < size; i++)
+            h = (h ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+        return h;
+    }
+
+    class recordWriter {
+    public:
+        void put(int64_t v) { bytes.append((const char *) &v, sizeof(v)); }
+        void put(double v) { bytes.append((const char *) &v, sizeof(v)); }
+        void put(const std::string &s)
+        {
+            put((int64_t) s.size());
+            bytes.append(s);
+        }
+        std::string bytes;
+    };
+
+    class recordReader {
+    public:
+        recordReader(const char *data, size_t size) : data(data), size(size) {}
+
+        int64_t getInt()
+        {
+            int64_t v = 0;
+            take(&v, sizeof(v));
+            return v;
+        }
+        double getDouble()
+        {
+            double v = 0;
+            take(&v, sizeof(v));
+            return v;
+        }
+        std::string getString()
+        {
+            int64_t length = getInt();
+            if (!ok || length < 0 || (size_t) length > size - pos) {
+                ok = false;
+                return "";
+            }
+            std::string s(data + pos, length);
+            pos += length;
+            return s;
+        }
+        bool failed() const { return !ok; }
+        bool good() const { return ok && pos == size; }
+
+    private:
+        void take(void *out, size_t n)
+        {
+            if (!ok || n > size - pos) {
+                ok = false;
+                return;
+            }
+            memcpy(out, data + pos, n);
+            pos += n;
+        }
+
+        const char *data;
+        size_t size;
+        size_t pos = 0;
+        bool ok = true;
+    };
+
+    std::string dataRoot()
+    {
+        const char *xdg = getenv("XDG_DATA_HOME");
+        if (xdg && *xdg)
+            return std::string(xdg) + "/scv";
+        const char *home = getenv("HOME");
+        if (home && *home)
+            return std::string(home) + "/.local/share/scv";
+        return "";
+    }
+
+    std::string encodeRecord(const runner::sessionRecord &r)
+    {
+        recordWriter w;
+        w.put((int64_t) r.timestamp);
+        w.put(r.encoder);
+        w.put(r.host);
+        w.put(r.content.si);
+        w.put(r.content.ti);
+        w.put(r.content.noise);
+        w.put((int64_t) r.content.sceneCuts);
+        w.put((int64_t) r.content.framesAnalyzed);
+        w.put((int64_t) r.xRes);
+        w.put((int64_t) r.yRes);
+        w.put((int64_t) r.bits);
+        w.put((int64_t) r.fpsNum);
+        w.put((int64_t) r.fpsDenom);
+        w.put(r.videoLength);
+        w.put(r.vmafTarget);
+        w.put((int64_t) r.useQFactor);
+        w.put((int64_t) r.useTwoPass);
+        w.put((int64_t) r.targetTimeRatio);
+        w.put(r.timeCostRatio);
+        w.put(r.timescaleTarget);
+        w.put(r.cores);
+        w.put((int64_t) r.useCPUTime);
+        w.put((int64_t) r.params.size());
+        for (size_t i = 0; i < r.params.size(); i++) {
+            w.put(r.params.at(i).first);
+            w.put(r.params.at(i).second);
+        }
+        w.put(r.fastRate);
+        w.put(r.rate);
+        w.put(r.vmaf);
+        w.put((int64_t) r.size);
+        w.put(r.cpuTime);
+        w.put(r.realTime);
+        w.put((int64_t) r.encodes);
+        w.put((int64_t) r.coarseScale);
+        w.put(r.coarseRatio);
+        return w.bytes;
+    }
+
+    bool decodeRecord(const char *data, size_t size, uint32_t version, runner::sessionRecord &r)
+    {
+        recordReader in(data, size);
+        r.timestamp = in.getInt();
+        r.encoder = in.getString();
+        r.host = in.getString();
+        r.content.si = in.getDouble();
+        r.content.ti = in.getDouble();
+        r.content.noise = in.getDouble();
+        r.content.sceneCuts = in.getInt();
+        r.content.framesAnalyzed = in.getInt();
+        r.content.valid = r.content.framesAnalyzed > 0;
+        r.xRes = in.getInt();
+        r.yRes = in.getInt();
+        r.bits = in.getInt();
+        r.fpsNum = in.getInt();
+        r.fpsDenom = in.getInt();
+        r.videoLength = in.getDouble();
+        r.vmafTarget = in.getDouble();
+        r.useQFactor = in.getInt() != 0;
+        r.useTwoPass = in.getInt() != 0;
+        r.targetTimeRatio = in.getInt() != 0;
+        r.timeCostRatio = in.getDouble();
+        r.timescaleTarget = in.getDouble();
+        r.cores = in.getDouble();
+        r.useCPUTime = in.getInt() != 0;
+        int64_t paramCount = in.getInt();
+        for (int64_t i = 0; i < paramCount && !in.failed(); i++) {
+            std::string name = in.getString();
+            std::string label = in.getString();
+            r.params.push_back(std::make_pair(name, label));
+        }
+        r.fastRate = in.getDouble();
+        r.rate = in.getDouble();
+        r.vmaf = in.getDouble();
+        r.size = in.getInt();
+        r.cpuTime = in.getDouble();
+        r.realTime = in.getDouble();
+        r.encodes = in.getInt();
+        if (version >= 2) {
+            r.coarseScale = in.getInt();
+            r.coarseRatio = in.getDouble();
+        }
+        return in.good() && r.fpsDenom > 0 && r.xRes > 0 && r.yRes > 0;
+    }
+
+    // Content features are compared on a log scale, the vmaf target in units of 4 points and the
+    // resolution by the log of the pixel count ratio
+    double distance(const runner::sessionRecord &a, const runner::sessionRecord &b)
+    {
+        auto logDiff = [] (double x, double y) -> double {
+            return std::log(1 + std::max(0.0, x)) - std::log(1 + std::max(0.0, y));
+        };
+        double cutsA = a.videoLength > 0 ? a.content.sceneCuts / a.videoLength * 60 : 0;
+        double cutsB = b.videoLength > 0 ? b.content.sceneCuts / b.videoLength * 60 : 0;
+        double d = 0;
+        d += std::pow(logDiff(a.content.si, b.content.si), 2);
+        d += std::pow(logDiff(a.content.ti, b.content.ti), 2);
+        d += 0.5 * std::pow(logDiff(a.content.noise, b.content.noise), 2);
+        d += 0.25 * std::pow(logDiff(cutsA, cutsB), 2);
+        d += std::pow((a.vmafTarget - b.vmafTarget) / 4, 2);
+        d += 0.25 * std::pow(std::log((double) a.xRes * a.yRes / ((double) b.xRes * b.yRes)), 2);
+        return std::sqrt(d);
+    }
+
+    double modelBitrate(const runner::sessionRecord &r, double vmafTarget)
+    {
+        runner::runSettings rs;
+        rs.xRes = r.xRes;
+        rs.yRes = r.yRes;
+        rs.videoFPSNum = r.fpsNum;
+        rs.videoFPSDenom = r.fpsDenom;
+        return runner::predictBitrate(r.content, rs, vmafTarget);
+    }
+
+    bool sameObjective(const runner::sessionRecord &a, const runner::sessionRecord &b)
+    {
+        if (a.targetTimeRatio != b.targetTimeRatio || a.useCPUTime != b.useCPUTime)
+            return false;
+        if (a.targetTimeRatio)
+            return std::abs(a.timeCostRatio - b.timeCostRatio) <= 0.01 * std::abs(a.timeCostRatio);
+        return std::abs(a.timescaleTarget - b.timescaleTarget) <= 0.01 * a.timescaleTarget && std::abs(a.cores - b.cores) < 0.01;
+    }
+}
+
+runner::resultStore::resultStore(const std::string &path) :
+    path(path == "-" ? "" : (path.empty() ? (dataRoot().empty() ? "" : dataRoot() + "/results.log") : path))
+{
+}
+
+std::vector<runner::sessionRecord> runner::resultStore::load() const
+{
+    std::vector<sessionRecord> records;
+    if (!enabled())
+        return records;
+    std::ifstream in(path, std::ios::binary);
+    std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    while (pos + frameSize <= log.size()) {
+        uint32_t version, length;
+        uint64_t sum;
+        const char *frame = log.data() + pos;
+        memcpy(&version, frame + 4, 4);
+        memcpy(&length, frame + 8, 4);
+        // Anything that does not frame up is skipped a byte at a time until the next record
+        if (memcmp(frame, recordMagic, 4) != 0 || version < 1 || version > recordVersion || length > log.size() - pos - frameSize) {
+            pos++;
+            continue;
+        }
+        const char *payload = frame + 12;
+        memcpy(&sum, payload + length, 8);
+        sessionRecord r;
+        if (sum != checksum(payload, length) || !decodeRecord(payload, length, version, r)) {
+            pos++;
+            continue;
+        }
+        records.push_back(r);
+        pos += frameSize + length;
+    }
+    return records;
+}
+
+bool runner::resultStore::append(const sessionRecord &record) const
+{
+    if (!enabled())
+        return false;
+    std::string payload = encodeRecord(record);
+    uint32_t length = payload.size();
+    uint64_t sum = checksum(payload.data(), payload.size());
+    std::string frame(recordMagic, 4);
+    frame.append((const char *) &recordVersion, 4);
+    frame.append((const char *) &length, 4);
+    frame.append(payload);
+    frame.append((const char *) &sum, 8);
+
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        _mkdir(path.substr(0, slash).c_str());
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write(fd, frame.data(), frame.size()) == (ssize_t) frame.size();
+    close(fd);
+    return written;
+}
+
+runner::historySeed runner::resultStore::seed(const sessionRecord &current, const parameterSpace &space, const paramSweep &sweep) const
+{
+    historySeed s;
+    if (!current.content.valid)
+        return s;
+
+    std::vector<std::pair<double, sessionRecord>> similar;
+    std::vector<sessionRecord> records = load();
+    for (size_t i = 0; i < records.size(); i++) {
+        const sessionRecord &r = records.at(i);
+        if (r.encoder != current.encoder || r.bits != current.bits || r.useQFactor != current.useQFactor
+            || r.useTwoPass != current.useTwoPass || !r.content.valid || r.rate <= 0)
+            continue;
+        double d = distance(current, r);
+        if (d <= maxDistance)
+            similar.push_back(std::make_pair(d, r));
+    }
+    if (similar.empty())
+        return s;
+    std::stable_sort(similar.begin(), similar.end(), [] (const std::pair<double, sessionRecord> &a, const std::pair<double, sessionRecord> &b) {
+        return a.first < b.first;
+    });
+    s.matches = similar.size();
+    s.distance = similar.front().first;
+
+    // Each neighbour says how far the content model was off for it, and the weighted mean of that
+    // correction is applied to the model's prediction for this clip. q factors are averaged directly.
+    double weightSum = 0, fastResidual = 0, rateResidual = 0;
+    for (size_t i = 0; i < similar.size() && i < rateNeighbours; i++) {
+        const sessionRecord &r = similar.at(i).second;
+        double w = 1.0 / (similar.at(i).first + 0.05);
+        weightSum += w;
+        if (current.useQFactor) {
+            fastResidual += w * r.fastRate;
+            rateResidual += w * r.rate;
+        } else {
+            double fast = r.fastRate > 0 ? r.fastRate : r.rate;
+            fastResidual += w * std::log(fast / modelBitrate(r, r.vmafTarget * 0.9));
+            rateResidual += w * std::log(r.rate / modelBitrate(r, r.vmaf));
+        }
+    }
+    if (current.useQFactor) {
+        s.fastRate = fastResidual / weightSum;
+        s.rate = rateResidual / weightSum;
+    } else {
+        s.fastRate = modelBitrate(current, current.vmafTarget * 0.9) * std::exp(fastResidual / weightSum);
+        s.rate = modelBitrate(current, current.vmafTarget) * std::exp(rateResidual / weightSum);
+    }
+    s.rateValid = true;
+
+    // The full to coarse resolution rate ratio only depends on the content, so it comes from the neighbours that
+    // measured one at the same scale
+    double ratioWeights = 0, logRatio = 0;
+    for (size_t i = 0, used = 0; i < similar.size() && used < rateNeighbours; i++) {
+        const sessionRecord &r = similar.at(i).second;
+        if (r.coarseScale != current.coarseScale || r.coarseRatio <= 0)
+            continue;
+        double w = 1.0 / (similar.at(i).first + 0.05);
+        ratioWeights += w;
+        logRatio += w * std::log(r.coarseRatio);
+        used++;
+    }
+    if (ratioWeights > 0) {
+        s.coarseRatio = std::exp(logRatio / ratioWeights);
+        s.coarseValid = true;
+    }
+
+    // Encode times only transfer between sessions on the same machine aiming for the same speed
+    for (size_t i = 0; i < similar.size() && !s.paramsValid; i++) {
+        const sessionRecord &r = similar.at(i).second;
+        if (r.host != current.host || !sameObjective(r, current))
+            continue;
+        paramPoint p = sweep.first();
+        bool complete = true;
+        for (size_t d = 0; d < sweep.searchedDimensions().size() && complete; d++) {
+            const std::string &name = space.dimensions().at(sweep.searchedDimensions().at(d)).name;
+            complete = false;
+            for (size_t k = 0; k < r.params.size(); k++) {
+                if (r.params.at(k).first == name)
+                    complete = space.set(p, name, r.params.at(k).second);
+            }
+        }
+        if (!complete)
+            continue;
+        paramPoint q = sweep.first();
+        while (q != p && sweep.next(q, q)) {
+        }
+        if (q == p) {
+            s.params = p;
+            s.paramsValid = true;
+        }
+    }
+    return s;
+}
+
+std::string runner::encoderVersion(const runSettings &rs)
+{
+    return encoderFor(rs).version();
+}
+
+runner::sessionRecord runner::currentSession(const runSettings &rs, const contentFeatures &content, const std::string &encoder)
+{
+    sessionRecord r;
+    r.timestamp = time(NULL);
+    r.encoder = encoder;
+    char host[256] = {0};
+    if (gethostname(host, sizeof(host) - 1) == 0)
+        r.host = host;
+    r.content = content;
+    r.xRes = rs.xRes;
+    r.yRes = rs.yRes;
+    r.bits = rs.bits;
+    r.fpsNum = rs.videoFPSNum;
+    r.fpsDenom = rs.videoFPSDenom;
+    r.videoLength = rs.videoLength;
+    r.vmafTarget = rs.vmafTarget;
+    r.useQFactor = rs.useQFactor;
+    r.useTwoPass = rs.useTwoPass;
+    r.targetTimeRatio = rs.targetTimeRatio;
+    r.timeCostRatio = rs.timeCostRatio;
+    r.timescaleTarget = rs.timescaleTarget;
+    r.cores = rs.cores;
+    r.useCPUTime = rs.useCPUTime;
+    r.coarseScale = rs.coarseScale;
+    return r;
+}
+
+void runner::recordChoice(sessionRecord &record, const singleRun &chosen, const parameterSpace &space)
+{
+    record.params.clear();
+    for (size_t i = 0; i < space.dimensions().size(); i++)
+        record.params.push_back(std::make_pair(space.dimensions().at(i).name, space.label(chosen.params, i)));
+    record.rate = record.useQFactor ? chosen.qFactor : chosen.bitrate;
+    record.vmaf = chosen.vmaf;
+    record.size = chosen.videoSize;
+    record.cpuTime = chosen.netCpuTime;
+    record.realTime = chosen.realTime;
+}
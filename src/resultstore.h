@@ -0,0 +1,111 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "content.h"
+#include "paramspace.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace runner
+{
+    // What one finished session chose, with everything that decides whether it applies to another clip
+    struct sessionRecord {
+        long long timestamp = 0;
+        // Encoder build and machine, timings only carry over when both match
+        std::string encoder;
+        std::string host;
+        contentFeatures content;
+        int xRes = 0;
+        int yRes = 0;
+        int bits = 8;
+        int fpsNum = 1;
+        int fpsDenom = 1;
+        double videoLength = 0;
+        double vmafTarget = 0;
+        bool useQFactor = false;
+        bool useTwoPass = true;
+        // The speed objective the parameters were chosen for
+        bool targetTimeRatio = false;
+        double timeCostRatio = 0;
+        double timescaleTarget = 0;
+        double cores = 1;
+        bool useCPUTime = true;
+        // Chosen parameters as csv column and value label, so records outlive changes to the parameter space
+        std::vector<std::pair<std::string, std::string>> params;
+        // Pass 1's rate at the fastest settings and 90% of the target, and the final rate (or q factor)
+        double fastRate = 0;
+        double rate = 0;
+        double vmaf = 0;
+        long long size = 0;
+        double cpuTime = 0;
+        double realTime = 0;
+        long encodes = 0;
+        // Pass 1's full resolution rate over the rate the coarse search found at 1/coarseScale of the size, 0 if not measured
+        int coarseScale = 0;
+        double coarseRatio = 0;
+    };
+
+    // Starting points for a new session taken from the most similar past sessions
+    struct historySeed {
+        bool rateValid = false;
+        double fastRate = 0;
+        double rate = 0;
+        bool paramsValid = false;
+        paramPoint params;
+        bool coarseValid = false;
+        double coarseRatio = 0;
+        // Records that were close enough to use, and the distance to the closest
+        long matches = 0;
+        double distance = 0;
+    };
+
+    // Results of past sessions in an append-only binary log. Every record is framed with a magic number,
+    // a format version, its length and a checksum, so a torn or damaged record is skipped rather than
+    // ending the log. Records are in native byte order; the log is not meant to move between machines.
+    class resultStore {
+    public:
+        // An empty path uses $XDG_DATA_HOME/scv/results.log or ~/.local/share/scv/results.log, "-" disables the store
+        resultStore(const std::string &path);
+
+        bool enabled() const { return !path.empty(); }
+        const std::string &location() const { return path; }
+
+        std::vector<sessionRecord> load() const;
+        // Writes the record with a single append so sessions running at the same time do not interleave
+        bool append(const sessionRecord &record) const;
+
+        // Rates come from the nearest compatible records, corrected for content, resolution and target through
+        // predictBitrate, and so does the coarse rate ratio. Parameters come from the nearest one on this host with the same speed objective,
+        // as long as they are a point of sweep.
+        historySeed seed(const sessionRecord &current, const parameterSpace &space, const paramSweep &sweep) const;
+
+    private:
+        std::string path;
+    };
+
+    // The version line of rs.encodingProgram, or just the program name if there is none
+    std::string encoderVersion(const runSettings &rs);
+    // Fills in the parts of a record that are known before the first encode
+    sessionRecord currentSession(const runSettings &rs, const contentFeatures &content, const std::string &encoder);
+    // Sets a record's chosen parameters and result from the run a session settled on
+    void recordChoice(sessionRecord &record, const singleRun &chosen, const parameterSpace &space);
+};
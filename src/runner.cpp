@@ -17,6 +17,28 @@
  */
 
 #include "runner.h"
+#include "process.h"
+#include "scheduler.h"
+#include "passcache.h"
+#include "vmafscorer.h"
+#include "framequeue.h"
+#include "decoder.h"
+#include "ivf.h"
+#include "framestore.h"
+#include "refcache.h"
+#include "ratesearch.h"
+#include "scaling.h"
+#include "frontier.h"
+#include "surrogate.h"
+#include "content.h"
+#include "resultstore.h"
+#include "sampling.h"
+#include "chunks.h"
+#include "pipeline.h"
+#include "proxymetric.h"
+#include "timing.h"
+#include "encoders.h"
+#include <algorithm>
 #include <math.h>
 #include <iostream>
 #include <sys/stat.h>
@@ -29,10 +51,25 @@
 #include <unistd.h>
 #include <sstream>
 #include <fstream>
+#include <cstring>
+#include <memory>
 
 
 #define INBUF_SIZE 4096
 
+namespace {
+    // Halves step when the score is too close to call at it. Returns false when the score can stand.
+    bool denserStep(const runner::singleRun &sr, int &step)
+    {
+        if (step <= 1 || !runner::needsDenserScore(sr))
+            return false;
+        step /= 2;
+        std::cout << "vmaf " << sr.vmaf << " (" << sr.vmafLow << " to " << sr.vmafHigh << ") is too close to call, scoring every "
+                  << step << " frames" << std::endl;
+        return true;
+    }
+}
+
 void runner::_mkdir(const char *dir) {
     char tmp[PATH_MAX];
     char *p = NULL;
@@ -54,29 +91,43 @@ void runner::_mkdir(const char *dir) {
 
 void runner::doSimulations(runner::runSettings rs)
 {
-    auto nextSpeed = [] (int speed, bool altTune, bool fwdKF) -> int {
-        int trueSpeed = speed & 31;
-        if (trueSpeed > 4 || (trueSpeed > 1 && (speed & 65536) != 65536)) {
-            return speed - 1;
-        }
-
-        bool fastDeadline = ((speed & 65536) == 65536);
-        if (fastDeadline) {
-            return (5 + 96 + 128);
-        }
-
-        int altTuneInt = speed & 96;
-
-        if (fwdKF && ( (speed & 128) == 128)) {
-            return (speed + 4 - 128);
-        } else if (altTune && altTuneInt > 0) {
-            if (fwdKF)
-                return (speed + 4 + 128 - 32);
-            else
-                return (speed + 4 - 32);
-        }
-        return 0;
-    };
+    std::unique_ptr<rateSearch> rateSearcher = makeRateSearch(rs.rateSearchStrategy);
+    if (!rateSearcher) {
+        std::cout << "Unknown rate search strategy " << rs.rateSearchStrategy << std::endl;
+        return;
+    }
+    const encoderBackend *encoder = findEncoder(rs.encodingProgram);
+    if (!encoder) {
+        std::cout << "Unknown encoder " << rs.encodingProgram << ", use one of: " << encoderNames() << std::endl;
+        return;
+    }
+    if (rs.bits > encoder->maxBits()) {
+        std::cout << encoder->name() << " only encodes up to " << encoder->maxBits() << " bits" << std::endl;
+        return;
+    }
+    if (rs.chunks > 1 && encoder->container() != encoderContainer::ivf) {
+        std::cout << "Chunks are joined as IVF, which " << encoder->name() << " does not write, encoding every trial in one piece" << std::endl;
+        rs.chunks = 0;
+    }
+    const parameterSpace &space = encoder->parameters();
+    std::vector<std::string> searched = encoder->defaultSearch();
+    for (size_t i = 0; i < rs.searchedParameters.size(); i++) {
+        if (std::find(searched.begin(), searched.end(), rs.searchedParameters.at(i)) == searched.end())
+            searched.push_back(rs.searchedParameters.at(i));
+    }
+    paramSweep sweep(space, searched);
+    if (!sweep.unknownName().empty()) {
+        std::cout << "Unknown encoder parameter " << sweep.unknownName() << ", use one of: " << space.csvHeader() << std::endl;
+        return;
+    }
+    if (rs.optimizer != "passes" && rs.optimizer != "surrogate") {
+        std::cout << "Unknown optimizer " << rs.optimizer << std::endl;
+        return;
+    }
+    if (rs.countHardwareEvents && !perfCountersAvailable())
+        rs.countHardwareEvents = false;
+    // How many encodes each pass needed to converge
+    std::vector<long> encodesPerPass(4, 0);
 
     std::ofstream myfile;
     if (rs.outputCSV) {
@@ -90,15 +141,16 @@ void runner::doSimulations(runner::runSettings rs)
             }
         }
         myfile.open(rs.outputCSVFile);
-        if (rs.useQFactor) {
-            myfile << "Test#, Qfac, vmaf, Pass1CTime, Pass2CTime, NetCTime, NetRT, Speed, Tune, FwdKF, RTDeadline, Size";
-        } else {
-            myfile << "Test#, Bitrate, vmaf, Pass1CTime, Pass2CTime, NetCTime, NetRT, Speed, Tune, FwdKF, RTDeadline, Size";
-        }
+        myfile << resultCsvHeader(rs);
     }
 
 
     std::vector<singleRun> runsList;
+    std::vector<std::string> commandList;
+    frameStore reference;
+    // referenceCached keeps the reference when it is the cache's own copy
+    bool referenceCached = false;
+    bool referenceReused = false;
     // Get video parameters, decode source, and other initialization
 
 
@@ -112,11 +164,13 @@ void runner::doSimulations(runner::runSettings rs)
 
         _mkdir(rs.temporaryStorageLocation.c_str());
 
-        std::string outfilename = (rs.temporaryStorageLocation + "/rawsource.yuv");
+        std::string frameStoreLocation = rs.frameStoreLocation.empty() ? rs.temporaryStorageLocation : rs.frameStoreLocation;
+        _mkdir(frameStoreLocation.c_str());
+        std::string outfilename = (frameStoreLocation + "/rawsource.yuv");
 
         /* open input file, and allocate format context */
         if (avformat_open_input(&fmt_ctx, rs.inputFile.c_str(), NULL, NULL) < 0) {
-            fprintf(stderr, "Could not open source file %s\n", outfilename.c_str());
+            fprintf(stderr, "Could not open source file %s\n", rs.inputFile.c_str());
             exit(1);
         }
 
@@ -127,55 +181,7 @@ void runner::doSimulations(runner::runSettings rs)
         }
 
 
-        [] (int *stream_idx, AVCodecContext **dec_ctx, AVFormatContext *fmt_ctx, enum AVMediaType type) {
-            int ret, stream_index;
-            AVStream *st;
-            AVCodec *dec = NULL;
-            AVDictionary *opts = NULL;
-
-            ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
-            if (ret < 0) {
-                fprintf(stderr, "Could not find %s stream in input file\n",
-                        av_get_media_type_string(type));
-                return ret;
-            } else {
-                stream_index = ret;
-                st = fmt_ctx->streams[stream_index];
-
-                /* find decoder for the stream */
-                dec = avcodec_find_decoder(st->codecpar->codec_id);
-                if (!dec) {
-                    fprintf(stderr, "Failed to find %s codec\n",
-                            av_get_media_type_string(type));
-                    return AVERROR(EINVAL);
-                }
-
-                /* Allocate a codec context for the decoder */
-                *dec_ctx = avcodec_alloc_context3(dec);
-                if (!*dec_ctx) {
-                    fprintf(stderr, "Failed to allocate the %s codec context\n",
-                            av_get_media_type_string(type));
-                    return AVERROR(ENOMEM);
-                }
-
-                /* Copy codec parameters from input stream to output codec context */
-                if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0) {
-                    fprintf(stderr, "Failed to copy %s codec parameters to decoder context\n",
-                            av_get_media_type_string(type));
-                    return ret;
-                }
-
-                /* Init the decoders, with or without reference counting */
-                av_dict_set(&opts, "refcounted_frames", "0", 0);
-                if ((ret = avcodec_open2(*dec_ctx, dec, &opts)) < 0) {
-                    fprintf(stderr, "Failed to open %s codec\n",
-                            av_get_media_type_string(type));
-                    return ret;
-                }
-                *stream_idx = stream_index;
-            }
-            return 0;
-        }(&idx, &context, fmt_ctx, AVMEDIA_TYPE_VIDEO);
+        openDecoder(&idx, &context, fmt_ctx, AVMEDIA_TYPE_VIDEO);
         stream = fmt_ctx->streams[idx];
 
         rs.videoxRes = context->width;
@@ -209,172 +215,713 @@ void runner::doSimulations(runner::runSettings rs)
         rs.videoFrames = (int) (rs.videoLength * ((double) stream->avg_frame_rate.num/stream->avg_frame_rate.den));
         rs.videoFPSNum = stream->avg_frame_rate.num;
         rs.videoFPSDenom = stream->avg_frame_rate.den;
-        rs.uncompressedVideoSize = stream->codecpar->color_space * rs.videoFrames * rs.xRes * rs.yRes * 1.5;
-        std::cout << "px format is " << stream->codecpar->format << std::endl;
-        if (stream->codecpar->format == 0) {
-            rs.videoDepth = 8;
-        } else if (stream->codecpar->format == 64) {
-            // 12 and 10 are the same once encoded to yuv.
-            rs.videoDepth = 12;
-        } else {
-            std::cout << "Unable to determine pixel format of source video. Please use yuv420p and little endian encoding for >8 bits" << std::endl;
-            exit(1);
-        }
+        rs.uncompressedVideoSize = rs.videoFrames * rs.xRes * rs.yRes * 1.5 * (rs.bits > 8 ? 2 : 1);
+        const char *pixFmtName = av_get_pix_fmt_name(context->pix_fmt);
+        std::cout << "Source pixel format is " << (pixFmtName ? pixFmtName : "unknown") << std::endl;
+        // The reference is converted to the test bit depth while it is scaled, whatever the source format.
+        rs.videoDepth = rs.bits;
 
 
         std::cout << "The input video stream has a duration of " << rs.videoLength << " seconds and a size of " << rs.videoSize / 1024 / 1024 << "MB" << std::endl;
-        std::cout << "Converting to raw before running tests... Be sure the destination has the required space" << std::endl;
-        std::cout << "Total space needed for testing is roughly: " << 2.1 * rs.uncompressedVideoSize / 1024.0 / 1024.0 << "MB" << std::endl;
-        std::cout << "Press any key to start running tests, or ^C to cancel." << std::endl;
-        std::getchar();
 
-        std::string ffmpegCmd = "ffmpeg -i '" + rs.inputFile + "' -s " + std::to_string(rs.xRes) + "x" + std::to_string(rs.yRes) +
-        " " + outfilename;
+        // Reuse a reference prepared by an earlier session when there is one
+        referenceCache refCache(rs.referenceCacheLocation, rs.referenceCacheBudget);
+        std::string cacheKey;
+        if (refCache.enabled()) {
+            std::cout << "Hashing input to look for a cached reference" << std::endl;
+            cacheKey = referenceCache::key(rs.inputFile, rs.xRes, rs.yRes, rs.bits);
+            std::string cachedPath = refCache.lookup(cacheKey, frameStore::frameSizeFor(rs.xRes, rs.yRes, rs.bits));
+            // The cache only saves the decode, with -m the reference is still copied to where it was asked for
+            if (!cachedPath.empty() && rs.frameStoreLocation.empty()) {
+                if (reference.open(cachedPath, rs.xRes, rs.yRes, rs.bits, rs.useHugePages)) {
+                    std::cout << "Using cached reference " << cachedPath << std::endl;
+                    outfilename = cachedPath;
+                    referenceCached = true;
+                    referenceReused = true;
+                }
+            } else if (!cachedPath.empty() && referenceCache::copyFile(cachedPath, outfilename) &&
+                       reference.open(outfilename, rs.xRes, rs.yRes, rs.bits, rs.useHugePages)) {
+                std::cout << "Copied cached reference " << cachedPath << " to " << outfilename << std::endl;
+                referenceReused = true;
+            }
+        }
+        bool cacheReference = !referenceReused && refCache.enabled() && refCache.fits(rs.uncompressedVideoSize);
+
+        int ret = 0;
+        if (!referenceReused) {
+            std::cout << "Converting to raw in " << outfilename << " before running tests... Be sure the destination has the required space" << std::endl;
+            std::cout << "Total space needed for testing is roughly: " << 1.0 * rs.uncompressedVideoSize / 1024.0 / 1024.0 << "MB" << std::endl;
+            std::cout << "Press any key to start running tests, or ^C to cancel." << std::endl;
+            std::getchar();
+
+            // Decode and scale the source straight into the memory mapped reference
+            enum AVPixelFormat storeFormat = AV_PIX_FMT_YUV420P;
+            if (rs.bits == 10)
+                storeFormat = AV_PIX_FMT_YUV420P10LE;
+            else if (rs.bits == 12)
+                storeFormat = AV_PIX_FMT_YUV420P12LE;
+
+            if (!reference.create(outfilename, rs.xRes, rs.yRes, rs.bits, rs.videoFrames, rs.useHugePages)) {
+                remove(outfilename.c_str());
+                exit(1);
+            }
+
+            SwsContext *sws = NULL;
+            bool storeFailed = false;
+            auto onFrame = [&] (AVFrame *frame) {
+                if (!sws) {
+                    sws = sws_getContext(frame->width, frame->height, (enum AVPixelFormat) frame->format,
+                                         rs.xRes, rs.yRes, storeFormat, SWS_BICUBIC, NULL, NULL, NULL);
+                }
+                uint8_t *planes[4];
+                int strides[4];
+                if (!sws || !reference.appendFrame(planes, strides)) {
+                    storeFailed = true;
+                    return;
+                }
+                sws_scale(sws, frame->data, frame->linesize, 0, frame->height, planes, strides);
+            };
+
+            auto decodeStart = std::chrono::steady_clock::now();
+            AVFrame *frame = av_frame_alloc();
+            while (ret >= 0 && !storeFailed && av_read_frame(fmt_ctx, pkt) >= 0) {
+                if (pkt->stream_index == idx)
+                    ret = decode(context, frame, pkt, onFrame);
+                av_packet_unref(pkt);
+            }
+            if (ret >= 0 && !storeFailed)
+                ret = decode(context, frame, NULL, onFrame);
+            reference.finish();
+            double decodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - decodeStart).count();
+            av_frame_free(&frame);
+            sws_freeContext(sws);
+
+            if (ret < 0 || storeFailed || reference.frames() == 0) {
+                std::cout << "Error decoding " << rs.inputFile << " into " << outfilename << std::endl;
+                remove(outfilename.c_str());
+                exit(1);
+            }
+            std::cout << "Decoded " << reference.frames() << " frames in " << decodeSeconds << "s ("
+                      << reference.frames() / std::max(decodeSeconds, 0.001) << " fps)" << std::endl;
+
+            if (cacheReference) {
+                if (refCache.commit(cacheKey, reference)) {
+                    std::cout << "Added the reference to the cache in " << rs.referenceCacheLocation << std::endl;
+                } else {
+                    std::cout << "Unable to add the reference to the cache" << std::endl;
+                }
+            }
+        }
+
+        av_packet_free(&pkt);
+        avcodec_free_context(&context);
+        avformat_close_input(&fmt_ctx);
 
-        int status = std::system(ffmpegCmd.c_str());
+        rs.referenceFile = reference.path();
+        rs.videoFrames = reference.frames();
+        rs.uncompressedVideoSize = reference.frames() * reference.frameSize();
+    }
 
-        /*
-        if (status != 0) {
-            std::cout << "Error running ffmpeg command: " << ffmpegCmd << std::endl;
-            remove(outfilename.c_str());
-            exit(status);
-        }*/
+    // Source complexity gives a better first bitrate guess than a fixed one
+    contentFeatures content;
+    if (rs.analyzeContent) {
+        content = analyzeContent(reference);
+        if (content.valid) {
+            std::cout << "Content analysis: SI " << content.si << ", TI " << content.ti << ", noise " << content.noise << ", "
+                      << content.sceneCuts << " scene cuts in " << content.framesAnalyzed << " frames" << std::endl;
+            rs.initialBitrate = predictBitrate(content, rs, rs.vmafTarget * 0.9);
+            std::cout << "Predicted starting bitrate: " << (int) rs.initialBitrate << "kbps" << std::endl;
+        }
     }
 
+    // Similar clips from past sessions know the rate and settings better than the content model does
+    resultStore history(rs.resultStoreLocation);
+    bool recordSession = history.enabled() && content.valid;
+    sessionRecord session;
+    historySeed seed;
+    if (recordSession) {
+        session = currentSession(rs, content, encoderVersion(rs));
+        seed = history.seed(session, space, sweep);
+        if (seed.rateValid) {
+            std::cout << "Found " << seed.matches << " similar past sessions in " << history.location()
+                      << ", the closest at a distance of " << seed.distance << std::endl;
+            if (!rs.useQFactor) {
+                rs.initialBitrate = seed.fastRate;
+                std::cout << "Starting bitrate from past sessions: " << (int) rs.initialBitrate << "kbps" << std::endl;
+            }
+        }
+    }
+
+    // On long inputs, search on a few segments that look like the whole clip instead of all of it.
+    // fullRs keeps describing the whole input for the verification encode.
+    runSettings fullRs = rs;
+    fullRs.temporaryStorageLocation = rs.temporaryStorageLocation + "/full";
+    frameStore sampled;
+    bool sampling = false;
+    std::vector<double> activity;
+    if (rs.sampleSegments > 0 || rs.chunks > 1)
+        activity = frameActivity(reference);
+    if (rs.sampleSegments > 0) {
+        long length = std::max(1L, (long) std::lround(rs.sampleSeconds * rs.videoFPSNum / rs.videoFPSDenom));
+        std::vector<segment> segments = pickSegments(activity, rs.sampleSegments, length);
+        std::string frameStoreLocation = rs.frameStoreLocation.empty() ? rs.temporaryStorageLocation : rs.frameStoreLocation;
+        if (segments.empty()) {
+            std::cout << "The input is too short for " << rs.sampleSegments << " segments of " << length << " frames, searching on all of it" << std::endl;
+        } else if (buildSampledReference(reference, segments, frameStoreLocation + "/sampled.yuv", sampled, rs.useHugePages)) {
+            sampling = true;
+            std::cout << "Searching on " << segments.size() << " segments of " << length << " frames, starting at frames:";
+            for (size_t i = 0; i < segments.size(); i++)
+                std::cout << " " << segments.at(i).start << (segments.at(i).atSceneCut ? "*" : "");
+            std::cout << " (* starts a scene)" << std::endl;
+            rs.referenceFile = sampled.path();
+            rs.videoFrames = sampled.frames();
+            rs.videoLength = (double) sampled.frames() * rs.videoFPSDenom / rs.videoFPSNum;
+            rs.uncompressedVideoSize = sampled.frames() * sampled.frameSize();
+        } else {
+            std::cout << "Unable to build the sampled reference, searching on all of the input" << std::endl;
+            remove((frameStoreLocation + "/sampled.yuv").c_str());
+        }
+    }
+
+    // Chunks are at least a second long so every chunk still has something to encode after its keyframe
+    if (rs.chunks > 1) {
+        long second = std::max(1L, (long) std::lround((double) rs.videoFPSNum / rs.videoFPSDenom));
+        fullRs.chunkStarts = chunkStarts(sceneCutFrames(activity), reference.frames(), rs.chunks, second);
+        rs.chunkStarts = sampling ? chunkStarts(sceneCutFrames(frameActivity(sampled)), sampled.frames(), rs.chunks, second) : fullRs.chunkStarts;
+        std::cout << "Encoding every trial as " << rs.chunkStarts.size() << " chunks starting at frames:";
+        for (size_t i = 0; i < rs.chunkStarts.size(); i++)
+            std::cout << " " << rs.chunkStarts.at(i);
+        std::cout << std::endl;
+    }
+
+    // Pass 1 can look for its rate on a smaller copy of the reference first. Trials there are numbered
+    // coarsePassNumber and kept out of runsList, so the full resolution searches never mix them in.
+    const long coarsePassNumber = 7;
+    runSettings coarseRs = rs;
+    frameStore coarseReference;
+    bool coarse = false;
+    if (rs.coarseScale > 1 && rs.useQFactor) {
+        std::cout << "q factors do not carry over between resolutions, running pass 1 at full resolution" << std::endl;
+    } else if (rs.coarseScale > 1) {
+        const frameStore &source = sampling ? sampled : reference;
+        std::string frameStoreLocation = rs.frameStoreLocation.empty() ? rs.temporaryStorageLocation : rs.frameStoreLocation;
+        coarseRs.xRes = std::max(16, rs.xRes / rs.coarseScale / 2 * 2);
+        coarseRs.yRes = std::max(16, rs.yRes / rs.coarseScale / 2 * 2);
+        coarseRs.temporaryStorageLocation = rs.temporaryStorageLocation + "/coarse";
+        if (buildScaledReference(source, coarseRs.xRes, coarseRs.yRes, frameStoreLocation + "/coarse.yuv", coarseReference, rs.useHugePages)) {
+            coarse = true;
+            coarseRs.referenceFile = coarseReference.path();
+            coarseRs.uncompressedVideoSize = coarseReference.frames() * coarseReference.frameSize();
+        } else {
+            std::cout << "Unable to build the coarse reference, running pass 1 at full resolution" << std::endl;
+            remove((frameStoreLocation + "/coarse.yuv").c_str());
+        }
+    }
+
+    auto cleanUp = [&] () {
+        if (rs.outputCSV)
+            myfile.close();
+        if (coarse)
+            remove(coarseReference.path().c_str());
+        if (sampling)
+            remove(sampled.path().c_str());
+        if (!referenceCached)
+            remove(reference.path().c_str());
+        if (encoder->y4mInput()) {
+            remove(y4mPath(coarseReference.path()).c_str());
+            remove(y4mPath(sampled.path()).c_str());
+            remove(y4mPath(reference.path()).c_str());
+        }
+    };
+
+    // Encodes the whole input with the settings chosen on the segments and reports how far the
+    // segments' vmaf, bitrate and speed were from the real thing
+    auto verifySampledChoice = [&] (size_t chosenIndex) {
+        if (!sampling || !rs.verifySampling)
+            return;
+        std::cout << "Verifying the chosen settings on the whole input" << std::endl;
+        singleRun full;
+        full.optimizationPassNumber = 6;
+        full.params = runsList.at(chosenIndex).params;
+        full.bitrate = runsList.at(chosenIndex).bitrate;
+        full.qFactor = runsList.at(chosenIndex).qFactor;
+        std::string c;
+        {
+            trialScheduler fullScheduler(fullRs, &reference);
+            c = fullScheduler.run(full);
+        }
+        rmdir(fullRs.temporaryStorageLocation.c_str());
+        runsList.push_back(full);
+        commandList.push_back(c);
+        printResult(full, fullRs, &myfile);
+
+        const singleRun &part = runsList.at(chosenIndex);
+        double partKbps = part.videoSize * 8 / rs.videoLength / 1000;
+        double fullKbps = full.videoSize * 8 / fullRs.videoLength / 1000;
+        double partSpeed = rs.videoLength / (rs.useCPUTime ? part.netCpuTime : part.realTime);
+        double fullSpeed = fullRs.videoLength / (rs.useCPUTime ? full.netCpuTime : full.realTime);
+        std::cout << "Segment prediction error against the whole input:" << std::endl;
+        std::cout << "  vmaf " << part.vmaf << " predicted, " << full.vmaf << " measured, error " << part.vmaf - full.vmaf << std::endl;
+        std::cout << "  bitrate " << partKbps << "kbps predicted, " << fullKbps << "kbps measured, error " << 100 * (partKbps / fullKbps - 1) << "%" << std::endl;
+        std::cout << "  speed " << partSpeed << "s of video per second predicted, " << fullSpeed << " measured, error " << 100 * (partSpeed / fullSpeed - 1) << "%" << std::endl;
+    };
+
+    if (!rs.pinCpus.empty() || rs.timingPrecision > 0)
+        prepareTiming(rs);
+    trialScheduler scheduler(rs, sampling ? &sampled : &reference);
 
     // Pass 1 encapsulation
     // Pass 1 quickly finds a rough bitrate for the target vmaf we seek by searching for this bitrate
     // on the fastest speed settings
     double optimalRate;
     bool optimalRateFound = false;
+    proxyCalibration calibration;
+    long proxyEncodes = 0;
+    // Once a couple of trials were scored both ways the rest of the pass only needs the proxy. With -Q pass 1 picks
+    // the final cq-level, as there is no pass 3, so every trial of it is scored with vmaf.
+    auto runFastTrial = [&] (trialScheduler &trials, singleRun &sr, proxyCalibration &cal, long &proxied) -> std::string {
+        sr.proxyScored = rs.proxyMetric && !rs.useQFactor && cal.ready();
+        std::string c = trials.run(sr);
+        proxyResult proxy;
+        proxy.psnr = sr.psnr;
+        proxy.ssim = sr.ssim;
+        if (sr.proxyScored) {
+            sr.vmaf = cal.predict(proxy);
+            sr.vmafLow = sr.vmaf;
+            sr.vmafHigh = sr.vmaf;
+            proxied++;
+        } else if (!sr.tooSlow) {
+            cal.add(proxy, sr.vmaf);
+        }
+        return c;
+    };
     std::cout << "Running fast rate optimization" << std::endl;
+    if (rs.proxyMetric && !rs.useQFactor)
+        std::cout << "Scoring with " << proxyKernelName() << " PSNR / SSIM once it is calibrated against vmaf" << std::endl;
+
+    // The full resolution search starts from the coarse rate times the ratio similar past sessions measured,
+    // or the pixel count ratio to the power 0.75 without them
+    double coarseRate = 0;
+    double predictedRatio = 0;
+    if (coarse) {
+        predictedRatio = seed.coarseValid ? seed.coarseRatio : std::pow((double) rs.xRes * rs.yRes / ((double) coarseRs.xRes * coarseRs.yRes), 0.75);
+        std::vector<singleRun> coarseRuns;
+        proxyCalibration coarseCalibration;
+        long coarseProxied = 0;
+        std::cout << "Searching at " << coarseRs.xRes << "x" << coarseRs.yRes << " first" << std::endl;
+        {
+            trialScheduler coarseScheduler(coarseRs, &coarseReference);
+            while (coarseRate <= 0) {
+                double trueTarget = rs.vmafTarget * 0.9;
+                double trueEpsilon = 1.0;
+                singleRun sr;
+                sr.params = sweep.first();
+                sr.optimizationPassNumber = coarsePassNumber;
+                sr.scoreTarget = trueTarget;
+                sr.scoreEpsilon = trueEpsilon;
+                sr.bitrate = rateSearcher->nextBitrate(coarseRuns, trueTarget, sr.optimizationPassNumber, sr.params, rs.initialBitrate / predictedRatio);
+                runFastTrial(coarseScheduler, sr, coarseCalibration, coarseProxied);
+                coarseRuns.push_back(sr);
+                printResult(sr, coarseRs, &myfile);
+                if (withinTarget(sr, trueTarget, trueEpsilon))
+                    coarseRate = sr.bitrate;
+            }
+        }
+        rmdir(coarseRs.temporaryStorageLocation.c_str());
+        rs.initialBitrate = coarseRate * predictedRatio;
+        std::cout << "Coarse search converged at " << (int) coarseRate << "kbps after " << coarseRuns.size() << " encodes ("
+                  << coarseProxied << " scored by the proxy), starting the full resolution search at " << (int) rs.initialBitrate
+                  << "kbps with a rate ratio of " << predictedRatio << (seed.coarseValid ? " from past sessions" : "") << std::endl;
+    }
+
     while (!optimalRateFound) {
         double trueTarget = rs.vmafTarget * 0.9;
         double trueEpsilon = 1.0;
         singleRun sr;
-        sr.speed = 65536 + 8 + 128 + 96;
+        sr.params = sweep.first();
         sr.optimizationPassNumber = 1;
+        sr.scoreTarget = trueTarget;
+        sr.scoreEpsilon = rs.useQFactor ? 0 : trueEpsilon;
         if (!rs.useQFactor) {
-            sr.bitrate = getNextTestBitrate(runsList, trueTarget, sr.optimizationPassNumber);
+            sr.bitrate = rateSearcher->nextBitrate(runsList, trueTarget, sr.optimizationPassNumber, sr.params, rs.initialBitrate);
         } else {
-            sr.qFactor = getNextTestQFactor(runsList, rs.vmafTarget, sr.optimizationPassNumber);
+            int bestQ = 0;
+            int q = getNextTestQFactor(runsList, rs.vmafTarget, sr.optimizationPassNumber, bestQ,
+                                       seed.rateValid ? (int) std::lround(seed.fastRate) : encoder->defaultQuality(), encoder->maxQuality());
+            if (q < 0) {
+                optimalRate = bestQ;
+                optimalRateFound = true;
+                break;
+            }
+            sr.qFactor = q;
         }
-        runSim(sr, rs, &myfile);
+        commandList.push_back(runFastTrial(scheduler, sr, calibration, proxyEncodes));
+        encodesPerPass.at(1)++;
         //std::cout << sr.vmaf << " when run with a bitrate of " << sr.bitrate << std::endl;
 
         runsList.push_back(sr);
-        //std::cout << "Number of runs to analyze: " << runsList.size() << std::endl;
+        printResult(sr, rs, &myfile);
 
-        if (rs.useQFactor) {
-            double q = getNextTestQFactor(runsList, rs.vmafTarget, sr.optimizationPassNumber);
-            if (std::abs(q - sr.qFactor) <= 1) {
-                optimalRate = std::max(q, sr.qFactor);
-                optimalRateFound = true;
-            }
-        } else if (std::abs(sr.vmaf - trueTarget) < trueEpsilon) {
+        if (!rs.useQFactor && withinTarget(sr, trueTarget, trueEpsilon)) {
             optimalRateFound = true;
             optimalRate = sr.bitrate;
         }
     }
+    std::cout << "Fast rate optimization converged after " << encodesPerPass.at(1) << " encodes" << std::endl;
+    if (proxyEncodes > 0)
+        std::cout << proxyEncodes << " of them scored by the proxy, " << calibration.describe() << std::endl;
+    session.fastRate = optimalRate;
+    if (coarse) {
+        double measuredRatio = optimalRate / coarseRate;
+        session.coarseRatio = measuredRatio;
+        std::cout << "Full to coarse resolution rate ratio: " << predictedRatio << " predicted, " << measuredRatio << " measured, "
+                  << "the full resolution search started " << 100 * (predictedRatio / measuredRatio - 1) << "% off" << std::endl;
+    }
+
+    // Encoder threading does not scale linearly, so measure it instead of dividing the target by the core count
+    scalingModel scaling;
+    if (rs.measureScaling) {
+        int maxThreads = rs.cores > 1 ? (int) std::ceil(rs.cores) : 1;
+        int hardwareThreads = std::thread::hardware_concurrency();
+        if (rs.cores <= 1 && hardwareThreads > 0)
+            maxThreads = hardwareThreads;
+        if (hardwareThreads > 0 && maxThreads > hardwareThreads)
+            maxThreads = hardwareThreads;
+        std::cout << "Measuring multi-core scaling with up to " << maxThreads << " threads" << std::endl;
+
+        singleRun base;
+        base.params = encoder->scalingPoint();
+        base.bitrate = optimalRate;
+        base.qFactor = optimalRate;
+        scaling = measureScaling(rs, base, maxThreads);
+        if (scaling.valid) {
+            std::cout << "Serial fraction is " << scaling.serialFraction << ", predicted speedup with " << rs.cores << " cores is " << scaling.speedup(rs.cores);
+            if (rs.cores > maxThreads)
+                std::cout << " (extrapolated beyond the " << maxThreads << " threads measured)";
+            std::cout << std::endl;
+        } else {
+            std::cout << "Unable to fit a scaling model, assuming linear scaling" << std::endl;
+        }
+    }
+
+    if (rs.frontierMode) {
+        std::cout << "Exploring the speed and size tradeoff at a vmaf of " << rs.vmafTarget << std::endl;
+        frontierExplorer explorer(rs, sweep, scheduler, *rateSearcher);
+        std::vector<frontierPoint> frontier = explorer.explore(optimalRate, runsList, commandList, &myfile);
+        std::cout << "Found " << frontier.size() << " non-dominated settings with " << explorer.encodes() << " encodes:" << std::endl;
+        printFrontier(frontier, rs, std::cout);
+        if (!rs.frontierCSVFile.empty()) {
+            std::ofstream frontierFile(rs.frontierCSVFile);
+            printFrontier(frontier, rs, frontierFile);
+        }
+
+        cleanUp();
+        return;
+    }
+
+    if (rs.optimizer == "surrogate") {
+        std::cout << "Optimizing with a surrogate model" << std::endl;
+        surrogateOptimizer optimizer(rs, sweep, scheduler, scaling.speedup(rs.cores));
+        size_t bestIndex = 0;
+        if (optimizer.optimize(optimalRate, runsList, commandList, &myfile, bestIndex)) {
+            std::cout << "Surrogate optimization converged after " << optimizer.encodes() << " encodes, "
+                      << encodesPerPass.at(1) + optimizer.encodes() << " including pass 1" << std::endl;
+            std::cout << "Your ideal " << encoder->name() << " settings are: " << std::endl;
+            std::cout << commandList.at(bestIndex) << std::endl;
+            verifySampledChoice(bestIndex);
+            if (recordSession) {
+                recordChoice(session, runsList.at(bestIndex), space);
+                session.encodes = runsList.size();
+                if (!history.append(session))
+                    std::cout << "Unable to add this session to " << history.location() << std::endl;
+            }
+
+            cleanUp();
+            return;
+        }
+        // Everything it encoded is still in runsList, so the passes get to use it
+        std::cout << "Surrogate optimization found nothing usable after " << optimizer.encodes() << " encodes, falling back to the sequential passes" << std::endl;
+    }
 
     // Pass 2 encapsulation
-    // Pass 2 will find the optimal speed at a fixed optimalRate
-    long optimalSpeed = 65536 + 8 + 128 + 96;
+    // Pass 2 will find the optimal encoder parameters at a fixed optimalRate by sweeping from the fastest to the slowest
+    paramPoint optimalParams = sweep.first();
     bool optimalSpeedFound = false;
-    if (!rs.useCPUTime && rs.timeCostRatio <= 0) {
-        optimalSpeed = 0;
+    // The run the session settles on, recorded for future sessions
+    long chosenRun = -1;
+    if (rs.targetTimeRatio && rs.timeCostRatio <= 0) {
+        optimalParams = sweep.last();
         optimalSpeedFound = true;
     }
     std::cout << "Optimizing for speed." << std::endl;
 
+    // Pass 1 timed the fastest settings on this content, so with the relative costs of the parameter space skip
+    // ahead to the last point expected to take under half the time budget. If that is already too slow, start over.
+    paramPoint warmStart;
+    bool warmStarted = false;
+    long pass1Index = -1;
+    for (size_t i = 0; i < runsList.size(); i++) {
+        if (runsList.at(i).optimizationPassNumber == 1)
+            pass1Index = i;
+    }
+    if (!optimalSpeedFound && !rs.targetTimeRatio && seed.paramsValid) {
+        warmStart = seed.params;
+        warmStarted = true;
+        optimalParams = seed.params;
+        std::cout << "Starting the speed sweep at " << space.csvRow(seed.params) << ", chosen by a similar past session" << std::endl;
+    } else if (!optimalSpeedFound && !rs.targetTimeRatio && content.valid && pass1Index >= 0) {
+        double pass1Time = rs.useCPUTime ? runsList.at(pass1Index).netCpuTime : runsList.at(pass1Index).realTime;
+        double budget = rs.useCPUTime ? rs.videoLength * scaling.speedup(rs.cores) / rs.timescaleTarget : rs.videoLength / rs.timescaleTarget;
+        double firstCost = space.relativeCost(runsList.at(pass1Index).params);
+        paramPoint p = sweep.first();
+        paramPoint following;
+        while (sweep.next(p, following) && pass1Time * space.relativeCost(following) / firstCost < budget / 2)
+            p = following;
+        if (p != sweep.first()) {
+            warmStart = p;
+            warmStarted = true;
+            optimalParams = p;
+            std::cout << "Starting the speed sweep at " << space.csvRow(p) << ", predicted to take "
+                      << pass1Time * space.relativeCost(p) / firstCost << "s of " << budget << "s" << std::endl;
+        }
+    }
+
+    // With a pipeline, speed decisions are made as soon as a trial is encoded and the scores are collected after the
+    // sweep, so the next encodes run while earlier ones are scored. Pass 3 uses it to speculate on its next probe.
+    std::unique_ptr<trialPipeline> pipeline;
+    if (rs.pipelineScorers > 0)
+        pipeline.reset(new trialPipeline(rs, scheduler, rs.pipelineScorers));
+    std::vector<std::pair<size_t, long>> unscored;
+
+    // The last run of this sweep that was fast enough, which is the answer once a slower point is too slow
+    long lastFastIndex = -1;
     while (!optimalSpeedFound) {
-        singleRun sr;
-        sr.bitrate = optimalRate;
-        sr.qFactor = optimalRate;
-        sr.optimizationPassNumber = 2;
-        sr.speed = optimalSpeed;
-        std::string c = runSim(sr, rs, &myfile);
-        runsList.push_back(sr);
-        if (rs.targetTimeRatio && optimalSpeed == 0) {
-            double fitnessMax = 0;
-            int fittestIndex = 0;
-            int firstRunIndex = 0;
-            double powerUsed = std::log2(rs.targetTimeRatio);
-
-            for (int i = 0; i < runsList.size(); i++) {
-                if (runsList.at(i).optimizationPassNumber == 2) {
-                    if (firstRunIndex == 0)
-                        firstRunIndex = i;
-                    double netValue = std::pow(runsList.at(firstRunIndex).videoSize/ rs.videoSize, powerUsed);
-                    double rawCost;
-                    if (rs.useCPUTime) {
-                        rawCost = runsList.at(i).netCpuTime / runsList.at(firstRunIndex).netCpuTime;
-                    } else {
-                        rawCost = runsList.at(i).realTime / runsList.at(firstRunIndex).realTime;
-                    }
-                    if (netValue / rawCost > fitnessMax) {
-                        fitnessMax = netValue / rawCost;
-                        fittestIndex = i;
-                    }
+        // The points in the sweep do not depend on each other, so run as many as there are worker slots
+        // at once and then look at the results in sweep order.
+        std::vector<singleRun> batch;
+        paramPoint nextBatchParams = optimalParams;
+        while (true) {
+            singleRun sr;
+            sr.bitrate = optimalRate;
+            sr.qFactor = optimalRate;
+            sr.optimizationPassNumber = 2;
+            sr.params = nextBatchParams;
+            sr.timeRepeats = rs.timingPrecision > 0;
+            if (!rs.targetTimeRatio && rs.stopSlowTrials)
+                sr.timeBudget = rs.useCPUTime ? rs.videoLength * scaling.speedup(rs.cores) / rs.timescaleTarget : rs.videoLength / rs.timescaleTarget;
+            batch.push_back(sr);
+            if ((int) batch.size() >= scheduler.slots() || !sweep.next(nextBatchParams, nextBatchParams))
+                break;
+        }
+        std::vector<std::string> commands;
+        std::vector<long> tickets;
+        if (pipeline) {
+            commands.assign(batch.size(), "");
+            for (size_t b = 0; b < batch.size(); b++)
+                tickets.push_back(pipeline->submit(batch.at(b)));
+        } else {
+            scheduler.run(batch, commands);
+            encodesPerPass.at(2) += batch.size();
+        }
+
+        int chosenIndex = -1;
+        bool restartSweep = false;
+        for (size_t b = 0; b < batch.size(); b++) {
+            singleRun &sr = batch.at(b);
+            if (pipeline) {
+                // Points past the decision are not needed, stop them wherever they are
+                if (optimalSpeedFound || restartSweep) {
+                    pipeline->cancel(tickets.at(b));
+                    continue;
                 }
+                pipeline->waitEncoded(tickets.at(b), sr, commands.at(b));
+                encodesPerPass.at(2)++;
+                unscored.push_back(std::make_pair(runsList.size(), tickets.at(b)));
             }
-            optimalSpeed = runsList.at(fittestIndex).speed;
-            optimalSpeedFound = true;
-        } else if (!rs.targetTimeRatio) {
-            if (rs.useCPUTime && (rs.videoLength / sr.netCpuTime) < rs.timescaleTarget / rs.cores) {
-                optimalSpeed = runsList.at(runsList.size() - 2).speed;
-                optimalSpeedFound = true;
-            } else if (!rs.useCPUTime && (rs.videoLength / sr.realTime) < rs.timescaleTarget) {
-                optimalSpeed = runsList.at(runsList.size() - 2).speed;
+            runsList.push_back(sr);
+            commandList.push_back(commands.at(b));
+            if (!pipeline)
+                printResult(sr, rs, &myfile);
+            // Anything past the decision was already encoded, keep it in the results anyway.
+            if (optimalSpeedFound || restartSweep)
+                continue;
+
+            bool tooSlow = sr.tooSlow || (rs.useCPUTime ? (rs.videoLength / sr.netCpuTime) < rs.timescaleTarget / scaling.speedup(rs.cores)
+                                                        : (rs.videoLength / sr.realTime) < rs.timescaleTarget);
+            if (!rs.targetTimeRatio && warmStarted && sr.params == warmStart && tooSlow) {
+                std::cout << "The predicted starting point is already too slow, sweeping from the fastest settings" << std::endl;
+                restartSweep = true;
+                continue;
+            }
+
+            bool slowest = sweep.isLast(sr.params);
+            if (rs.targetTimeRatio && slowest) {
+                double fitnessMax = 0;
+                int fittestIndex = 0;
+                int firstRunIndex = -1;
+                // Spending timeCostRatio times as long is worth halving the size
+                double powerUsed = std::log2(rs.timeCostRatio);
+
+                for (int i = 0; i < runsList.size(); i++) {
+                    if (runsList.at(i).optimizationPassNumber == 2) {
+                        if (firstRunIndex < 0)
+                            firstRunIndex = i;
+                        double netValue = std::pow((double) runsList.at(firstRunIndex).videoSize / runsList.at(i).videoSize, powerUsed);
+                        double rawCost;
+                        if (rs.useCPUTime) {
+                            rawCost = runsList.at(i).netCpuTime / runsList.at(firstRunIndex).netCpuTime;
+                        } else {
+                            rawCost = runsList.at(i).realTime / runsList.at(firstRunIndex).realTime;
+                        }
+                        if (netValue / rawCost > fitnessMax) {
+                            fitnessMax = netValue / rawCost;
+                            fittestIndex = i;
+                        }
+                    }
+                }
+                chosenIndex = fittestIndex;
                 optimalSpeedFound = true;
+            } else if (!rs.targetTimeRatio) {
+                if (tooSlow) {
+                    // If even the first point of the sweep is too slow, it is still the closest to the target
+                    chosenIndex = lastFastIndex >= 0 ? lastFastIndex : runsList.size() - 1;
+                    optimalSpeedFound = true;
+                } else if (slowest) {
+                    // Even the slowest settings are fast enough
+                    chosenIndex = runsList.size() - 1;
+                    optimalSpeedFound = true;
+                } else {
+                    lastFastIndex = runsList.size() - 1;
+                }
             }
         }
-        if (rs.useQFactor && optimalSpeedFound) {
-            std::cout << "Your ideal aomenc settings are: " << std::endl;
-            std::cout << c << std::endl;
+        if (restartSweep) {
+            warmStarted = false;
+            lastFastIndex = -1;
+            optimalParams = sweep.first();
+        } else if (optimalSpeedFound) {
+            optimalParams = runsList.at(chosenIndex).params;
+            chosenRun = chosenIndex;
+            if (rs.useQFactor) {
+                std::cout << "Your ideal " << encoder->name() << " settings are: " << std::endl;
+                std::cout << commandList.at(chosenIndex) << std::endl;
+            }
+        } else {
+            sweep.next(batch.back().params, optimalParams);
         }
-        if (!optimalSpeedFound)
-            optimalSpeed = nextSpeed(optimalSpeed, rs.testAlternativeTunings, rs.testFwdFrames);
     }
 
+    for (size_t i = 0; i < unscored.size(); i++) {
+        std::string command;
+        pipeline->waitScored(unscored.at(i).second, runsList.at(unscored.at(i).first), command);
+        printResult(runsList.at(unscored.at(i).first), rs, &myfile);
+    }
+
+    // Speculative pass 3 probes by the bitrate they were started at
+    std::vector<std::pair<double, long>> speculative;
+
     // Pass 3 finds the exact bitrate and does nothing when q factor is used
     bool exactBitrateFound = false;
     double exactBitrate;
     std::cout << "Finding exact bitrate" << std::endl;
     while (!exactBitrateFound && !rs.useQFactor) {
         singleRun sr;
-        sr.speed = optimalSpeed;
+        sr.params = optimalParams;
         sr.optimizationPassNumber = 3;
-        sr.bitrate = getNextTestBitrate(runsList, rs.vmafTarget, sr.optimizationPassNumber, optimalRate);
-        std::string c = runSim(sr, rs, &myfile);
+        sr.scoreTarget = rs.vmafTarget;
+        sr.scoreEpsilon = rs.vmafEpsilon;
+        double firstGuess = seed.rateValid && seed.paramsValid && optimalParams == seed.params ? seed.rate : optimalRate;
+        sr.bitrate = rateSearcher->nextBitrate(runsList, rs.vmafTarget, sr.optimizationPassNumber, sr.params, firstGuess);
+        std::string c;
+        if (pipeline) {
+            // Use a speculative probe that is close enough to the rate the search wants and drop the rest
+            long ticket = -1;
+            for (size_t i = 0; i < speculative.size(); i++) {
+                if (ticket < 0 && std::abs(std::log(speculative.at(i).first / sr.bitrate)) < 0.03) {
+                    ticket = speculative.at(i).second;
+                    sr.bitrate = speculative.at(i).first;
+                    pipeline->adopt(ticket);
+                } else {
+                    pipeline->cancel(speculative.at(i).second);
+                }
+            }
+            speculative.clear();
+            if (ticket < 0)
+                ticket = pipeline->submit(sr);
+            pipeline->waitEncoded(ticket, sr, c);
+
+            // While this probe is scored, start the probe the search would want next if it just missed the target,
+            // on the low side and with a spare worker slot on the high side too
+            std::vector<singleRun> hypothetical = runsList;
+            hypothetical.push_back(sr);
+            int sides = scheduler.slots() > 1 ? 2 : 1;
+            for (int side = 0; side < sides; side++) {
+                hypothetical.back().vmaf = rs.vmafTarget + (side == 0 ? -2 : 2) * rs.vmafEpsilon;
+                singleRun next;
+                next.params = optimalParams;
+                next.optimizationPassNumber = 3;
+                next.scoreTarget = rs.vmafTarget;
+                next.scoreEpsilon = rs.vmafEpsilon;
+                next.bitrate = rateSearcher->nextBitrate(hypothetical, rs.vmafTarget, next.optimizationPassNumber, next.params, optimalRate);
+                if ((int) next.bitrate != (int) sr.bitrate)
+                    speculative.push_back(std::make_pair(next.bitrate, pipeline->submit(next, true)));
+            }
+            pipeline->waitScored(ticket, sr, c);
+        } else {
+            c = scheduler.run(sr);
+        }
+        encodesPerPass.at(3)++;
         //std::cout << sr.vmaf << " when run with a bitrate of " << sr.bitrate << std::endl;
         runsList.push_back(sr);
+        commandList.push_back(c);
+        printResult(sr, rs, &myfile);
 
-        if (std::abs(sr.vmaf - rs.vmafTarget) < rs.vmafEpsilon) {
+        if (withinTarget(sr, rs.vmafTarget, rs.vmafEpsilon)) {
             exactBitrateFound = true;
             exactBitrate = sr.bitrate;
-            std::cout << "Your ideal aomenc settings are: " << std::endl;
+            chosenRun = runsList.size() - 1;
+            std::cout << "Your ideal " << encoder->name() << " settings are: " << std::endl;
             std::cout << c << std::endl;
         }
         // the sim got stuck
         else if ( (int) (sr.bitrate) == (int) (runsList.at(runsList.size() - 2).bitrate) && runsList.at(runsList.size() - 2).optimizationPassNumber == 3) {
             exactBitrateFound = true;
             exactBitrate = sr.bitrate;
-            std::cout << "Your ideal aomenc settings are: " << std::endl;
+            chosenRun = runsList.size() - 1;
+            std::cout << "Your ideal " << encoder->name() << " settings are: " << std::endl;
             std::cout << c << std::endl;
         }
     }
 
-    if (rs.outputCSV) {
-        myfile.close();
+    if (chosenRun >= 0)
+        verifySampledChoice(chosenRun);
+
+    if (recordSession && chosenRun >= 0) {
+        recordChoice(session, runsList.at(chosenRun), space);
+        session.encodes = runsList.size();
+        if (!history.append(session))
+            std::cout << "Unable to add this session to " << history.location() << std::endl;
     }
 
-    std::string outfilename = (rs.temporaryStorageLocation + "/rawsource.yuv");
-    remove(outfilename.c_str());
+    if (scaling.valid && rs.cores > 1) {
+        int threads = (int) std::ceil(rs.cores);
+        std::cout << "On " << threads << " cores add:" << encoder->threadArguments(threads, rs) << std::endl;
+    }
+
+    std::cout << "Encodes used with " << rateSearcher->name() << " rate search: " << encodesPerPass.at(1) << " in pass 1, "
+              << encodesPerPass.at(2) << " in pass 2, " << encodesPerPass.at(3) << " in pass 3" << std::endl;
+    if (pipeline) {
+        for (size_t i = 0; i < speculative.size(); i++)
+            pipeline->cancel(speculative.at(i).second);
+        pipeline->printStats(std::cout);
+        pipeline.reset();
+    }
+
+    cleanUp();
     return;
 }
 
-double runner::getNextTestBitrate(std::vector<singleRun> &runsList, double target, long passNum, double defaultBR)
+double runner::getNextTestBitrate(const std::vector<singleRun> &runsList, double target, long passNum, double defaultBR)
 {
     std::vector<double> brList;
     std::vector<double> vmafList;
@@ -384,7 +931,6 @@ double runner::getNextTestBitrate(std::vector<singleRun> &runsList, double targe
             vmafList.push_back(runsList.at(i).vmaf);
         }
     }
-    std::cout << "Number of runs to analyze: " << std::to_string(brList.size()) << std::endl;
     if (brList.size() == 0) {
         return defaultBR;
     }
@@ -420,76 +966,89 @@ double runner::getNextTestBitrate(std::vector<singleRun> &runsList, double targe
     return (brList.at(closeHighIndex) + brList.at(closeLowIndex)) / 2.0;
 }
 
-double runner::getNextTestQFactor(std::vector<singleRun> &runsList, double target, long passNum, double defaultQ)
+int runner::getNextTestQFactor(const std::vector<singleRun> &runsList, double target, long passNum, int &bestQ, int defaultQ, int maxQ)
 {
-    std::vector<double> qList;
-    std::vector<double> vmafList;
+    const int minQ = 0;
+
+    // Every cq-level is only ever encoded once, so the runs double as a cache of vmaf by q
+    std::map<int, double> tried;
     for (int i = 0; i < runsList.size(); i++) {
         if (runsList.at(i).optimizationPassNumber == passNum) {
-            qList.push_back(runsList.at(i).qFactor);
-            vmafList.push_back(runsList.at(i).vmaf);
+            tried[(int) runsList.at(i).qFactor] = runsList.at(i).vmaf;
         }
     }
-    if (qList.size() == 0) {
-        return defaultQ;
+    if (tried.empty()) {
+        return std::max(minQ, std::min(maxQ, defaultQ));
     }
 
-    bool allLess = true;
-    bool allGreater = true;
-
-    int closeLowIndex;
-    int closeHighIndex;
-    double closeLow = -101;
-    double closeHigh = 101;
-    for (int i = 0; i < vmafList.size(); i++){
-        if (vmafList.at(i) > target) {
-            allLess = false;
-        } else {
-            allGreater = false;
-        }
-        double vmafDiff = std::abs(vmafList.at(i) - target);
-        if (closeLow < vmafDiff && vmafDiff < 0.0) {
-            closeLow = vmafDiff;
-            closeLowIndex = i;
-        } else if (closeHigh > vmafDiff && vmafDiff > 0.0) {
-            closeHigh = vmafDiff;
-            closeHighIndex = i;
-        }
+    // vmaf falls as q rises. low is the highest q that reaches the target and high the lowest q above it that does not.
+    int low = -1;
+    int high = -1;
+    for (auto it = tried.begin(); it != tried.end(); ++it) {
+        if (it->second >= target)
+            low = it->first;
     }
-    if (allLess) {
-        if (qList.at(vmafList.size() - 1) - 8 < 0) {
-            return 0;
-        } else {
-            return (int) (qList.at(vmafList.size() - 1) - 8);
-        }
-    } else if (allGreater) {
-        if (qList.at(vmafList.size() - 1) + 8 < 68)
-            return (int) (qList.at(vmafList.size() - 1) + 8);
-        else {
-            return 68;
+    for (auto it = tried.begin(); it != tried.end(); ++it) {
+        if (it->second < target && it->first > low) {
+            high = it->first;
+            break;
         }
     }
-    // if not get the middle between the two closest results.
-    return (int) ((qList.at(closeHighIndex) + qList.at(closeLowIndex)) / 2.0);
-}
 
+    if (low == maxQ || (low >= 0 && high == low + 1)) {
+        bestQ = low;
+        return -1;
+    }
+    if (low < 0 && tried.begin()->first == minQ) {
+        // Even lossless misses the target
+        bestQ = minQ;
+        return -1;
+    }
 
-std::string runner::runSim(runner::singleRun& sr, runner::runSettings rs, std::ofstream *myfile)
-{
-    bool twoRuns = ( (sr.speed & 65536) == 0 && rs.useTwoPass);
-    auto exec = [] (const char* cmd) {
-        std::array<char, 128> buffer;
-        std::string result;
-        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-        if (!pipe) {
-            throw std::runtime_error("popen() failed!");
-        }
-        while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-            result += buffer.data();
-        }
-        return result;
+    // Gallop away from the side that was tried until the target is bracketed. Once there are two points
+    // the step is shortened to just past where the line through them crosses the target.
+    auto extrapolate = [&] (int from, int other, int step) -> int {
+        if (from == other)
+            return step;
+        double slope = (tried[from] - tried[other]) / (from - other);
+        if (slope >= 0)
+            return step;
+        double estimate = (target - tried[from]) / slope;
+        int s = (int) std::ceil(std::abs(estimate)) + 1;
+        return std::max(1, std::min(step, s));
     };
+    if (high < 0) {
+        int step = std::max(4, 2 * (low - tried.begin()->first));
+        step = extrapolate(low, tried.begin()->first, step);
+        return std::min(maxQ, low + step);
+    }
+    if (low < 0) {
+        int step = std::max(4, 2 * (tried.rbegin()->first - high));
+        step = extrapolate(high, tried.rbegin()->first, step);
+        return std::max(minQ, high - step);
+    }
+
+    // Bracketed: interpolate, and bisect when interpolation would only shave an end off a wide bracket
+    double t = (tried[low] - target) / (tried[low] - tried[high]);
+    int next = low + (int) std::lround(t * (high - low));
+    next = std::max(low + 1, std::min(high - 1, next));
+    if (high - low > 4 && (next == low + 1 || next == high - 1))
+        next = (low + high) / 2;
+    return next;
+}
 
+std::string runner::encoderCommand(const runner::singleRun &sr, const runner::runSettings &rs, const std::string &passFile, const std::string &output, int runNumber)
+{
+    return encoderFor(rs).command(sr, rs, passFile, output, runNumber);
+}
+
+std::string runner::encodeTrial(runner::singleRun &sr, const runner::runSettings &rs, const trialContext &ctx,
+                                const std::function<void(const uint8_t *, size_t, int64_t)> &onPacket, const std::atomic<bool> *cancel)
+{
+    const encoderBackend &encoder = encoderFor(rs);
+    bool twoRuns = (encoder.twoPass() && !encoder.parameters().onePass(sr.params) && rs.useTwoPass);
+    // Trials on part of the reference, such as the scaling benchmark, are never split further
+    bool chunked = rs.chunkStarts.size() > 1 && sr.frameOffset == 0 && sr.frameLimit == 0;
     auto walltime = [] () -> double {
         struct timeval time;
         if (gettimeofday(&time,NULL)){
@@ -499,280 +1058,287 @@ std::string runner::runSim(runner::singleRun& sr, runner::runSettings rs, std::o
         return (double)time.tv_sec + (double)time.tv_usec * .000001;
     };
 
-    auto explainstring = [] (runner::singleRun& sr) -> std::string {
-        std::string e = "";
-        if ( (sr.speed & 65536) == 0) {
-            e += "Using 'good' deadline";
-        } else
-            e += "Using 'rt' deadline";
-        switch (sr.speed & 96) {
-            case 0:
-                e += "\nUsing vmaf_with_preprocessing tuning";
-                break;
-            case 32:
-                e += "\nUsing vmaf_without_preprocessing tuning";
-                break;
-            case 64:
-                e += "\nUsing ssim tuning";
-                break;
-            case 96:
-                e += "\nUsing psnr tuning";
-                break;
-        }
-        if ( (sr.speed & 128) != 128) {
-            e += "\nUsing forward keyframes";
-        } else {
-            e += "\nNot using forward keyframes";
-        }
-
-        e += "\nUsing cpu speed: " + std::to_string((sr.speed & 31));
-        return e;
-    };
-
-    auto cmdstring = [] (runner::singleRun& sr, runner::runSettings rs, int runNumber = 2) -> std::string {
-        std::string cmd = "aomenc";
-
-        cmd += " --bit-depth=" + std::to_string(rs.bits) + " --width=" + std::to_string(rs.xRes) + " --height=" + std::to_string(rs.yRes) + " --fps=" + std::to_string(rs.videoFPSNum) + "/" + std::to_string(rs.videoFPSDenom);
-
-        if (runNumber != 0)
-            cmd += " --fpf='" + rs.temporaryStorageLocation + "/passfile.dat'" + " --passes=2 --pass=" + std::to_string(runNumber);
-        else
-            cmd += " --passes=1 --pass=1";
-        cmd += " --input-bit-depth=" + std::to_string(rs.videoDepth);
-
-        if ( (sr.speed & 65536) != 0)
-            cmd += " --rt";
-        else
-            cmd += " --good";
-
-
-        if (rs.useQFactor)
-            cmd += " --end-usage=cq --cq-level=" + std::to_string(sr.qFactor);
-        else
-            cmd += " --end-usage=vbr --bias-pct=100 --target-bitrate=" + std::to_string((int) sr.bitrate);
-        if (rs.useQFactor && sr.qFactor == 0)
-            cmd += " --lossless=1";
-
-
-
-        int truespeed = sr.speed & 31;
-        cmd += " --cpu-used=" + std::to_string(truespeed);
-
-        bool forwardKF = ! ((sr.speed & 128) == 128);
-        int tuning = sr.speed & 96;
-        tuning = tuning / 32;
-        switch(tuning) {
-            case 0:
-                cmd += " --tune=vmaf_with_preprocessing";
-                break;
-            case 1:
-                cmd += " --tune=vmaf_without_preprocessing";
-                break;
-            case 2:
-                cmd += " --tune=ssim";
-                break;
-            case 3:
-                cmd += " --tune=psnr";
-                break;
-            default:
-                break;
-        }
-        // One every 10 seconds.
-        int keyframeDistance = (int) (rs.videoFrames / rs.videoLength * 10.0);
-
-        if (forwardKF)
-            cmd += " --enable-fwd-kf=1 --kf-max-dist=" + std::to_string(keyframeDistance);
-        else
-            cmd += " --enable-fwd-kf=0 --kf-max-dist=" + std::to_string(keyframeDistance);
-
-        cmd += " --ivf --output='" + rs.temporaryStorageLocation + "/output.ivf'" + " '" + rs.temporaryStorageLocation + "/rawsource.yuv'";
-
-        return cmd;
+    auto explainstring = [&] (runner::singleRun& sr) -> std::string {
+        return encoder.parameters().explain(sr.params);
     };
 
-    std::string readPath = "/proc/self/stat";
 
-    {
-        std::string token;
-        std::stringstream buf, buf2;
-        double cpuT1 = 0;
-
-        std::ifstream t1(readPath);
-        buf << t1.rdbuf();
-        for (int i = 0; i < 17; i++) {
-            buf >> token;
-            if (i >= 15) {
-                cpuT1 += atof(token.c_str());
-            }
-        }
-
-        int rn = twoRuns;
-        std::string cmd = cmdstring(sr, rs, rn);
+    if (!prepareEncoderInput(rs)) {
+        std::cout << "Unable to write the y4m copy of the reference " << encoder.name() << " reads, exiting." << std::endl;
+        exit(1);
+    }
+    _mkdir(ctx.workDir.c_str());
+
+    // Pass 1 stats do not depend on the bitrate, so reuse them when these settings were already run.
+    // The cached cpu and real time are still charged to this trial so results stay comparable.
+    std::string trialPassFile = ctx.workDir + "/passfile.dat";
+    std::string passFile = trialPassFile;
+    std::string passKey = firstPassCache::key(sr);
+    firstPassEntry cachedPass;
+    sr.firstPassCached = !chunked && twoRuns && ctx.passCache && ctx.passCache->lookup(passKey, cachedPass);
+    sr.realTime = 0;
+    sr.cpuTimeP1 = 0;
+    sr.usageP1 = processUsage();
+    sr.usageP2 = processUsage();
+    sr.tooSlow = false;
+
+    if (sr.firstPassCached) {
+        passFile = cachedPass.passFile;
+        sr.realTime = cachedPass.realTime;
+        sr.usageP1 = cachedPass.usage;
+        sr.cpuTimeP1 = sr.usageP1.cpuTime();
+    } else if (twoRuns && !chunked) {
+        std::string cmd = encoderCommand(sr, rs, passFile, "/dev/null", 1);
         //std::cout << explainstring(sr) << std::endl;
         //std::cout << "Running command:\n" << cmd << std::endl;
 
+        processUsage usage;
         double startRT = walltime();
 
-        if (system(cmd.c_str()) != 0) {
-            std::cout << "Error running aomenc, exiting." << std::endl;
+        processWatch watch;
+        watch.keepRunning = [&] (double cpuSeconds, double realSeconds) -> bool {
+            if (cancel && *cancel)
+                return false;
+            return sr.timeBudget <= 0 || (rs.useCPUTime ? cpuSeconds : realSeconds) <= sr.timeBudget;
+        };
+        int status = runCommand(cmd, usage, rs.countHardwareEvents, sr.timeBudget > 0 || cancel ? &watch : nullptr);
+        if (status != 0 && status != commandStopped) {
+            std::cout << "Error running " << encoder.name() << ", exiting." << std::endl;
             exit(1);
         }
         double endRT = walltime();
-        double cpuT2 = 0;
-
-        std::ifstream t2(readPath);
-        buf2 << t2.rdbuf();
-        for (int i = 0; i < 17; i++) {
-            buf2 >> token;
-            if (i >= 15) {
-                cpuT2 += atof(token.c_str());
-            }
-        }
-
 
         sr.realTime = endRT - startRT;
-        sr.cpuTimeP1 = (cpuT2 - cpuT1) / sysconf(_SC_CLK_TCK);
-
-        //std::cout << "Completed first pass aomenc run at speed " << sr.speed << std::endl;
-        //std::cout << "Starttime is " << (double) cpuT1/sysconf(_SC_CLK_TCK) << " end time is " << (double) cpuT2 / sysconf(_SC_CLK_TCK) << ". diff is " << (double) (cpuT2 - cpuT1) / sysconf(_SC_CLK_TCK) << std::endl;
-        //std::cout << "Starttime RT is " << startRT << " end time RT is " << endRT << ". diff is " << endRT - startRT << std::endl;
+        sr.usageP1 = usage;
+        sr.cpuTimeP1 = usage.cpuTime();
+        sr.tooSlow = status == commandStopped;
+        if (ctx.passCache && !sr.tooSlow)
+            passFile = ctx.passCache->store(passKey, passFile, usage, sr.realTime);
     }
 
-    if (!twoRuns) {
+    // Already over the budget in the first pass, an incomplete pass file is no use to anyone
+    if (sr.tooSlow) {
         sr.cpuTimeP2 = 0;
         sr.netCpuTime = sr.cpuTimeP1;
+        sr.videoSize = 0;
+        sr.vmaf = 0;
+        sr.vmafMin = 0;
+        sr.vmafFrames.clear();
+        remove(trialPassFile.c_str());
+        rmdir(ctx.workDir.c_str());
+        return encoderCommand(sr, rs, passFile, "output.ivf", 1);
+    }
 
-    } else {
-        std::string token;
-        std::stringstream buf, buf2;
-        double cpuT1 = 0;
-
-        std::ifstream t1(readPath);
-        buf << t1.rdbuf();
-        for (int i = 0; i < 17; i++) {
-            buf >> token;
-            if (i >= 15) {
-                cpuT1 += atof(token.c_str());
-            }
-        }
-
-
+    // Packets are split out of the stream as it arrives, by the IVF framing or by the codec's own parser
+    ivfReader ivf;
+    elementaryReader elementary(encoder.codec());
+    bool framed = encoder.container() == encoderContainer::ivf;
+    auto feed = [&] (const uint8_t *data, size_t size) {
+        if (framed)
+            ivf.feed(data, size, onPacket);
+        else
+            elementary.feed(data, size, onPacket);
+    };
+    long streamBytes = 0;
 
-        double startRT = walltime();
+    if (chunked) {
+        // Chunks are encoded to memory and joined, then handed on as one stream
+        std::vector<uint8_t> joined;
+        bool encoded = encodeChunks(sr, rs, ctx, twoRuns, joined, cancel);
+        streamBytes = joined.size();
+        ivf.feed(joined.data(), joined.size(), onPacket);
 
-        std::string cmd = cmdstring(sr, rs);
+        if (!encoded) {
+            std::cout << "Error running " << encoder.name() << ", exiting." << std::endl;
+            exit(1);
+        }
+    } else {
+        std::string cmd = encoderCommand(sr, rs, passFile, "-", twoRuns ? 2 : 0);
         //std::cout << explainstring(sr) << std::endl;
         //std::cout << "Running command:\n" << cmd << std::endl;
 
-        if (system(cmd.c_str()) != 0) {
-            std::cout << "Error running aomenc, exiting." << std::endl;
-            exit(1);
-        }
-        double endRT = walltime();
+        processUsage usage;
+        double startRT = walltime();
 
-        double cpuT2 = 0;
+        // Past the budget the trial is certainly too slow. Before that it is stopped once the rate frames come out
+        // at projects to twice the budget; output trails the encoder by its lookahead, so the projection waits for
+        // a tenth of the frames.
+        long totalFrames = sr.frameLimit > 0 ? sr.frameLimit : rs.videoFrames - sr.frameOffset;
+        processWatch watch;
+        watch.keepRunning = [&] (double cpuSeconds, double realSeconds) -> bool {
+            if (cancel && *cancel)
+                return false;
+            if (sr.timeBudget <= 0)
+                return true;
+            double before = rs.useCPUTime ? sr.cpuTimeP1 : sr.realTime;
+            double spent = rs.useCPUTime ? cpuSeconds : realSeconds;
+            if (before + spent > sr.timeBudget)
+                return false;
+            long done = framed ? ivf.frames() : elementary.frames();
+            if (done < std::max(totalFrames / 10, 30L))
+                return true;
+            return before + spent * totalFrames / done < 2 * sr.timeBudget;
+        };
+
+        int status = runCommand(cmd, usage, [&] (const uint8_t *data, size_t size) {
+            streamBytes += size;
+            feed(data, size);
+        }, rs.countHardwareEvents, sr.timeBudget > 0 || cancel ? &watch : nullptr);
+        if (!framed)
+            elementary.flush(onPacket);
+        double endRT = walltime();
 
-        std::ifstream t2(readPath);
-        buf2 << t2.rdbuf();
-        for (int i = 0; i < 17; i++) {
-            buf2 >> token;
-            if (i >= 15) {
-                cpuT2 += atof(token.c_str());
-            }
+        if (status != 0 && status != commandStopped) {
+            std::cout << "Error running " << encoder.name() << ", exiting." << std::endl;
+            exit(1);
         }
+        sr.tooSlow = status == commandStopped;
 
         sr.realTime = sr.realTime + endRT - startRT;
-        sr.cpuTimeP2 = (cpuT2 - cpuT1) / sysconf(_SC_CLK_TCK);
+        if (twoRuns) {
+            sr.usageP2 = usage;
+            sr.cpuTimeP2 = usage.cpuTime();
+        } else {
+            sr.usageP1 = usage;
+            sr.cpuTimeP1 = usage.cpuTime();
+            sr.cpuTimeP2 = 0;
+        }
         sr.netCpuTime = sr.cpuTimeP1 + sr.cpuTimeP2;
-        //std::cout << "Completed second pass aomenc run at speed " << sr.speed << std::endl;
-        //std::cout << "Starttime is " << (double) cpuT1/sysconf(_SC_CLK_TCK) << " end time is " << (double) cpuT2 / sysconf(_SC_CLK_TCK) << ". diff is " << (double) (cpuT2 - cpuT1) / sysconf(_SC_CLK_TCK) << std::endl;
-        //std::cout << "Starttime RT is " << startRT << " end time RT is " << endRT << ". diff is " << endRT - startRT << std::endl;
-
     }
-    std::string f1 = rs.temporaryStorageLocation + "/rawoutput.yuv";
-    std::string f2 = rs.temporaryStorageLocation + "/output.ivf";
-
-    struct stat filestatus;
-    stat(f2.c_str(), &filestatus );
-    sr.videoSize = filestatus.st_size;
-
-    std::string ffmpegCmd = "ffmpeg -i '" + f2 + "' -s " + std::to_string(rs.xRes) + "x" + std::to_string(rs.yRes) +
-    " '" + f1 + "'";
-
+    sr.videoSize = streamBytes;
 
-    if (system(ffmpegCmd.c_str()) != 0) {
-        std::cout << "Unable to convert output video to raw format" << std::endl;
-        exit(1);
-    }
-
-    std::stringstream buffer;
-    std::streambuf * old = std::cerr.rdbuf(buffer.rdbuf());
-
-    std::string vmafCmd = "vmafossexec yuv420p " + std::to_string(rs.xRes) + " " + std::to_string(rs.yRes) + " '" + rs.temporaryStorageLocation + "/rawsource.yuv' '" + f1 + "' '" + rs.vmafModel + "'";
-
-    std::string vmafOut = exec(vmafCmd.c_str());
-
-    std::size_t found = vmafOut.find("VMAF score = ");
-    found += 13;
-    std::string vmafVal = vmafOut.substr(found, vmafOut.size() - found);
-    sr.vmaf = std::atof(vmafVal.c_str());
-
-    int trueSpeed = sr.speed & 31;
-    bool fastDeadline = (sr.speed & 65536) == 65536;
-    int altTuneInt = sr.speed & 96;
-    std::string altTune = "";
-    switch (altTuneInt) {
-        case 0:
-            altTune = "vmaf_with_preprocessing";
-            break;
-        case 32:
-            altTune = "vmaf_without_preprocessing";
-            break;
-        case 64:
-            altTune = "ssim";
-            break;
-        case 96:
-            altTune = "psnr";
-            break;
+    // A pass file that went into the cache is removed with the cache
+    if (twoRuns && !chunked && passFile == trialPassFile && remove(trialPassFile.c_str()) != 0) {
+        std::cout << "Error removing " << trialPassFile << std::endl;
     }
-    bool fwdKF = (sr.speed & 128) != 128;
+    rmdir(ctx.workDir.c_str());
 
-    std::cout << "Results for run are:" << std::endl;
-    if (rs.useQFactor) {
-        std::cout << "Test#, Qfac, vmaf, Pass1CTime, Pass2CTime, NetCTime, NetRT, Speed, Tune, FwdKF, RTDeadline, Size" << std::endl;
-        if (rs.outputCSV)
-            *myfile << std::endl << sr.optimizationPassNumber << ", " << sr.qFactor << ", " << sr.vmaf << ", " << sr.cpuTimeP1 << ", " << sr.cpuTimeP2 << ", " << sr.netCpuTime << ", " << sr.realTime << ", " << trueSpeed << ", " << altTune << ", " << fwdKF << ", " << fastDeadline << ", " << sr.videoSize;
-
-        std::cout << sr.optimizationPassNumber << ", " << sr.qFactor << ", " << sr.vmaf << ", " << sr.cpuTimeP1 << ", " << sr.cpuTimeP2 << ", " << sr.netCpuTime << ", " << sr.realTime << ", " << trueSpeed << ", " << altTune << ", " << fwdKF << ", " << fastDeadline << ", " << sr.videoSize << std::endl;
-    } else {
-        std::cout << "Test#, Bitrate, vmaf, Pass1CTime, Pass2CTime, NetCTime, NetRT, Speed, Tune, FwdKF, RTDeadline, Size" << std::endl;
+    if (twoRuns)
+        return encoderCommand(sr, rs, passFile, "output.ivf", 1);
 
-        if (rs.outputCSV)
-            *myfile << std::endl << sr.optimizationPassNumber <<  ", " << sr.bitrate << ", " << sr.vmaf << ", " << sr.cpuTimeP1 << ", " << sr.cpuTimeP2 << ", " << sr.netCpuTime << ", " << sr.realTime << ", " << trueSpeed << ", " << altTune << ", " << fwdKF << ", " << fastDeadline << ", " << sr.videoSize;
+    return encoderCommand(sr, rs, passFile, "output.ivf", 0);
+}
 
-        std::cout << sr.optimizationPassNumber <<  ", " << sr.bitrate << ", " << sr.vmaf << ", " << sr.cpuTimeP1 << ", " << sr.cpuTimeP2 << ", " << sr.netCpuTime << ", " << sr.realTime << ", " << trueSpeed << ", " << altTune << ", " << fwdKF << ", " << fastDeadline << ", " << sr.videoSize << std::endl;
+std::string runner::runSim(runner::singleRun& sr, runner::runSettings rs, const trialContext &ctx)
+{
+    // The final pass streams out of the encoder and is decoded and scored as it arrives, so neither the
+    // encode nor its decoded frames are written to disk. The frame queue is bounded, so a scorer that
+    // falls behind stalls the encoder's output; that shows up in real time but not in cpu time.
+    frameQueue queue(rs.frameQueueDepth);
+    trialScorer scorer(rs, sr, ctx.reference, rs.vmafSubsample);
+    std::thread scoring([&] () {
+        AVFrame *frame;
+        while ((frame = queue.pop()) != nullptr) {
+            scorer.addFrame(frame);
+            av_frame_free(&frame);
+        }
+    });
+
+    // A subsampled score may have to be redone more densely, so keep the encode around for that
+    streamDecoder decoder(encoderFor(rs).codec());
+    std::vector<encodedPacket> kept;
+    long packets = 0;
+    auto onFrame = [&] (AVFrame *frame) {
+        queue.push(av_frame_clone(frame));
+    };
+    std::string command = encodeTrial(sr, rs, ctx, [&] (const uint8_t *data, size_t size, int64_t pts) {
+        packets++;
+        if (rs.vmafSubsample > 1) {
+            encodedPacket p;
+            p.data.assign(data, data + size);
+            p.pts = pts;
+            kept.push_back(p);
+        }
+        decoder.decode(data, size, pts, onFrame);
+    });
+    decoder.flush(onFrame);
+    queue.close();
+    scoring.join();
+
+    if (!sr.tooSlow && (packets == 0 || !decoder.good() || !scorer.good())) {
+        std::cout << "Unable to score the output of " << encoderFor(rs).name() << std::endl;
+        exit(1);
     }
+    scorer.finish(sr);
 
-    std::string f3 = rs.temporaryStorageLocation + "/passfile.dat";
+    int step = rs.vmafSubsample;
+    if (denserStep(sr, step))
+        scoreStoredTrial(sr, rs, ctx, kept, step);
+    repeatTiming(sr, rs, ctx);
+    return command;
+}
 
+bool runner::scoreStoredTrial(singleRun &sr, const runSettings &rs, const trialContext &ctx, const std::vector<encodedPacket> &packets,
+                              int step, const std::atomic<bool> *cancel)
+{
+    while (true) {
+        trialScorer scorer(rs, sr, ctx.reference, step);
+        streamDecoder decoder(encoderFor(rs).codec());
+        auto onFrame = [&] (AVFrame *frame) {
+            scorer.addFrame(frame);
+        };
+        for (size_t i = 0; i < packets.size() && !(cancel && *cancel); i++)
+            decoder.decode(packets.at(i).data.data(), packets.at(i).data.size(), packets.at(i).pts, onFrame);
+        if (cancel && *cancel)
+            return false;
+        decoder.flush(onFrame);
+
+        if (!sr.tooSlow && (packets.empty() || !decoder.good() || !scorer.good())) {
+            std::cout << "Unable to score the output of " << encoderFor(rs).name() << std::endl;
+            exit(1);
+        }
+        scorer.finish(sr);
 
-    if (remove(f1.c_str()) != 0) {
-        std::cout << "Error removing " << f1 << std::endl;
-    }
-    if (remove(f2.c_str()) != 0) {
-        std::cout << "Error removing " << f2 << std::endl;
-    }
-    if (remove(f3.c_str()) != 0) {
-        std::cout << "Error removing " << f3 << std::endl;
+        if (!denserStep(sr, step))
+            return true;
     }
-
-    if (twoRuns)
-        return cmdstring(sr, rs, 1);
-
-    return cmdstring(sr, rs, 0);
 }
 
+bool runner::withinTarget(const singleRun &sr, double target, double epsilon)
+{
+    return sr.vmafLow > target - epsilon && sr.vmafHigh < target + epsilon;
+}
 
+bool runner::needsDenserScore(const singleRun &sr)
+{
+    if (sr.scoreEpsilon <= 0 || sr.proxyScored)
+        return false;
+    bool below = sr.vmafHigh <= sr.scoreTarget - sr.scoreEpsilon;
+    bool above = sr.vmafLow >= sr.scoreTarget + sr.scoreEpsilon;
+    return !below && !above && !withinTarget(sr, sr.scoreTarget, sr.scoreEpsilon);
+}
 
+std::string runner::resultCsvHeader(const runSettings &rs)
+{
+    std::string header = std::string("Test#, ") + (rs.useQFactor ? "Qfac" : "Bitrate") + ", vmaf, Pass1CTime, Pass2CTime, NetCTime, NetRT, "
+                       + encoderFor(rs).parameters().csvHeader() + ", Size, P1Cached, VmafMin, UserUs, SysUs, PeakRSSKB, VolCtxSw, InvolCtxSw, MinFlt, MajFlt, TooSlow, PSNR, SSIM, ProxyScored, VmafLow, VmafHigh";
+    if (rs.countHardwareEvents)
+        header += perfCsvHeader("P1") + perfCsvHeader("P2");
+    if (rs.timingPrecision > 0)
+        header += timingCsvHeader();
+    return header;
+}
 
+std::string runner::resultCsvRow(const singleRun &sr, const runSettings &rs)
+{
+    // Resource columns cover both passes of the trial, the peak rss is the larger of the two
+    processUsage total = sr.usageP1;
+    total.add(sr.usageP2);
+    std::stringstream row;
+    row << sr.optimizationPassNumber << ", " << (rs.useQFactor ? sr.qFactor : sr.bitrate) << ", " << sr.vmaf << ", " << sr.cpuTimeP1 << ", " << sr.cpuTimeP2 << ", " << sr.netCpuTime << ", " << sr.realTime << ", " << encoderFor(rs).parameters().csvRow(sr.params) << ", " << sr.videoSize << ", " << sr.firstPassCached << ", " << sr.vmafMin << ", " << total.userMicros << ", " << total.sysMicros << ", " << total.maxRssKB << ", " << total.voluntarySwitches << ", " << total.involuntarySwitches << ", " << total.minorFaults << ", " << total.majorFaults << ", " << sr.tooSlow << ", " << sr.psnr << ", " << sr.ssim << ", " << sr.proxyScored << ", " << sr.vmafLow << ", " << sr.vmafHigh;
+    if (rs.countHardwareEvents)
+        row << perfCsvRow(sr.usageP1.counters) << perfCsvRow(sr.usageP2.counters);
+    if (rs.timingPrecision > 0)
+        row << timingCsvRow(sr);
+    return row.str();
+}
 
+void runner::printResult(const runner::singleRun &sr, const runner::runSettings &rs, std::ofstream *myfile)
+{
+    std::cout << "Results for run are:" << std::endl;
+    std::cout << resultCsvHeader(rs) << std::endl;
+    std::string row = resultCsvRow(sr, rs);
+    if (rs.outputCSV)
+        *myfile << std::endl << row;
+    std::cout << row << std::endl;
+}
@@ -18,6 +18,10 @@
 
 #pragma once
 
+#include "process.h"
+#include "paramspace.h"
+#include <atomic>
+#include <functional>
 #include <string>
 #include <vector>
 extern "C" {
@@ -26,6 +30,8 @@ extern "C" {
     #include <libavutil/timestamp.h>
     #include <libavformat/avformat.h>
     #include <libavcodec/avcodec.h>
+    #include <libavutil/pixdesc.h>
+    #include <libswscale/swscale.h>
 }
 
 
@@ -37,21 +43,63 @@ namespace runner
     struct runSettings {
         std::string temporaryStorageLocation = "/tmp/scv";
         std::string inputFile;
+        std::string frameStoreLocation = "";
+        std::string referenceFile;
+        // Keep decoded references here between sessions, empty disables the cache
+        std::string referenceCacheLocation = "";
+        long long referenceCacheBudget = 20480LL * 1024 * 1024;
+        // Log of past sessions used to seed new ones, empty for the default location and "-" to disable
+        std::string resultStoreLocation = "";
         std::string outputCSVFile = "";
+        // Encoder backend, one of the names in encoders.h
         std::string encodingProgram = "aomenc";
-        std::string vmafModel = "/usr/share/model/vmaf_v0.6.1.pkl";
+        std::string rateSearchStrategy = "secant";
+        std::string vmafModel = "vmaf_v0.6.1";
         double vmafTarget = 95;
         double vmafEpsilon = 0.5;
+        double initialBitrate = 10000;
         double timeCostRatio = 10;
         double timescaleTarget = 0.01;
         double cores = 1.0;
+        bool measureScaling = false;
+        bool analyzeContent = true;
+        // Search on this many short segments instead of the whole input, 0 searches on all of it
+        long sampleSegments = 0;
+        double sampleSeconds = 2;
+        // Encode the whole input once more with the chosen settings to report the sampling error
+        bool verifySampling = false;
+        // Search for pass 1's rate on the reference shrunk this many times in each direction first, 0 or 1 does not
+        int coarseScale = 0;
+        // Encode every trial as this many chunks at once, split at scene cuts, 0 or 1 encodes it in one piece
+        int chunks = 0;
+        // First frame of every chunk, filled in once the reference is ready
+        std::vector<long> chunkStarts;
+        // "passes" runs the sequential passes, "surrogate" the model based optimizer
+        std::string optimizer = "passes";
+        long surrogateBudget = 30;
+        // Map out every speed / size tradeoff at the vmaf target instead of picking one
+        bool frontierMode = false;
+        std::string frontierCSVFile = "";
+        int frontierPoints = 16;
         bool outputCSV = false;
         bool useCPUTime = true;
         bool targetTimeRatio = false;
         bool useQFactor = false;
         bool useTwoPass = true;
-        bool testAlternativeTunings = false;
-        bool testFwdFrames = false;
+        // Stop speed pass trials as soon as they can no longer meet the timescale target
+        bool stopSlowTrials = true;
+        // Score pass 1 with PSNR / SSIM mapped onto vmaf once a couple of its trials were scored with both
+        bool proxyMetric = true;
+        // Encoder parameters pass 2 sweeps on top of the backend's defaultSearch(), by csv column name
+        std::vector<std::string> searchedParameters;
+        bool useHugePages = false;
+        bool countHardwareEvents = false;
+        // Run encoders on these cpus only, such as "2-3,6", empty leaves them to the kernel
+        std::string pinCpus = "";
+        // Time speed pass trials again until the 95% interval of their time is narrower than this fraction of the mean,
+        // with at most timingMaxRuns repeats. 0 times every trial once.
+        double timingPrecision = 0;
+        int timingMaxRuns = 10;
         int bits = 8;
         int xRes = 0;
         int yRes = 0;
@@ -64,27 +112,113 @@ namespace runner
         long videoSize = 4096;
         long uncompressedVideoSize = 4096;
         int videoDepth = 8;
+        int jobs = 1;
+        int vmafThreads = 0;
+        // Score every vmafSubsample-th frame. Trials whose score is too close to call are rescored with twice the
+        // density until it is decided.
+        int vmafSubsample = 1;
+        int frameQueueDepth = 16;
+        // Score trials on this many threads of their own while the next encodes run, 0 scores every trial as it encodes
+        int pipelineScorers = 0;
+    };
+
+    class firstPassCache;
+    class frameStore;
+
+    // Spread of a time that was measured more than once
+    struct timingStats {
+        double mean = 0;
+        double stddev = 0;
+        double low = 0;
+        double high = 0;
     };
 
     struct singleRun {
-        long optimizationPassNumber;
-        double bitrate;
-        double qFactor;
-        long speed;
-        double realTime;
-        double cpuTimeP1;
-        double cpuTimeP2;
-        double netCpuTime;
-        double vmaf;
-        long videoSize;
+        long optimizationPassNumber = 0;
+        double bitrate = 0;
+        double qFactor = 0;
+        paramPoint params;
+        // 0 leaves threading to the encoder, otherwise the thread count with matching tiles and row-mt
+        int threads = 0;
+        // Encode only part of the reference, 0 for the whole video
+        long frameOffset = 0;
+        long frameLimit = 0;
+        // Stop the encode once it needs more than this many seconds of cpu (or real) time, 0 never stops it
+        double timeBudget = 0;
+        // Stopped by timeBudget; times, size and vmaf only cover what was encoded by then
+        bool tooSlow = false;
+        // Repeat the encode for its timing, see repeatTiming. The times are then the means of the repeats.
+        bool timeRepeats = false;
+        int timingRuns = 1;
+        timingStats cpuP1Stats;
+        timingStats cpuP2Stats;
+        timingStats netCpuStats;
+        timingStats realStats;
+        double realTime = 0;
+        double cpuTimeP1 = 0;
+        double cpuTimeP2 = 0;
+        double netCpuTime = 0;
+        double vmaf = 0;
+        double vmafMin = 0;
+        std::vector<double> vmafFrames;
+        // 95% interval of the vmaf score, which is just the score unless frames were subsampled
+        double vmafLow = 0;
+        double vmafHigh = 0;
+        // With scoreEpsilon set, subsampled scoring densifies until it can tell whether vmaf is within scoreEpsilon of scoreTarget
+        double scoreTarget = 0;
+        double scoreEpsilon = 0;
+        double psnr = 0;
+        double ssim = 0;
+        // Scored with psnr and ssim only, vmaf is left for the caller to estimate
+        bool proxyScored = false;
+        long videoSize = 0;
+        bool firstPassCached = false;
+        processUsage usageP1;
+        processUsage usageP2;
     };
+    // Where a single trial keeps its encoder output, pass file and decoded output.
+    struct trialContext {
+        long trialNumber = 0;
+        std::string workDir;
+        firstPassCache *passCache = nullptr;
+        const frameStore *reference = nullptr;
+    };
+    // One packet of a final pass kept in memory
+    struct encodedPacket {
+        std::vector<uint8_t> data;
+        int64_t pts;
+    };
+
     void doSimulations(runSettings rs);
 
-    double getNextTestBitrate(std::vector<singleRun> &runsList, double target, long passNum, double defaultBR = 10000);
-    double getNextTestQFactor(std::vector<singleRun> &runsList, double target, long passNum, double defaultQ = 30);
-    void decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt,
-                const char *filename);
-    std::string runSim(singleRun& sr, runSettings rs, std::ofstream *myfile = nullptr);
+    double getNextTestBitrate(const std::vector<singleRun> &runsList, double target, long passNum, double defaultBR = 10000);
+    // Integer search for the highest quantizer in 0-maxQ that still reaches target. Returns the next quantizer to encode,
+    // or -1 once the search has converged, in which case bestQ holds the answer.
+    int getNextTestQFactor(const std::vector<singleRun> &runsList, double target, long passNum, int &bestQ, int defaultQ = 30, int maxQ = 63);
+    int openDecoder(int *stream_idx, AVCodecContext **dec_ctx, AVFormatContext *fmt_ctx, enum AVMediaType type);
+    int decode(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt, const std::function<void(AVFrame *)> &onFrame);
+    // Decodes every video frame in filename. Returns the number of frames, or a negative value on error.
+    long decodeFile(const std::string &filename, const std::function<void(AVFrame *)> &onFrame);
+    // The command line of rs.encodingProgram for a trial. runNumber is 0 for single pass, otherwise the pass of a two pass encode.
+    std::string encoderCommand(const singleRun &sr, const runSettings &rs, const std::string &passFile, const std::string &output, int runNumber = 2);
+    // The encoder half of a trial: runs its passes and hands every packet of the final pass to onPacket as it streams
+    // out. Fills in everything but the vmaf scores and returns the command line. Setting cancel stops the encoder.
+    std::string encodeTrial(singleRun &sr, const runSettings &rs, const trialContext &ctx,
+                            const std::function<void(const uint8_t *, size_t, int64_t)> &onPacket, const std::atomic<bool> *cancel = nullptr);
+    // Encodes a trial and scores it as it streams out
+    std::string runSim(singleRun& sr, runSettings rs, const trialContext &ctx);
+    // Decodes a final pass kept in memory and scores every step-th frame of it, rescoring with twice the density
+    // while needsDenserScore. Returns false if cancel was set.
+    bool scoreStoredTrial(singleRun &sr, const runSettings &rs, const trialContext &ctx, const std::vector<encodedPacket> &packets,
+                          int step, const std::atomic<bool> *cancel = nullptr);
+    // Whether the whole interval of the score is within epsilon of target
+    bool withinTarget(const singleRun &sr, double target, double epsilon);
+    // Whether the interval of the score straddles an edge of sr.scoreEpsilon around sr.scoreTarget
+    bool needsDenserScore(const singleRun &sr);
+    // Columns of the results csv, the rate column is Qfac or Bitrate depending on rs
+    std::string resultCsvHeader(const runSettings &rs);
+    std::string resultCsvRow(const singleRun &sr, const runSettings &rs);
+    void printResult(const singleRun &sr, const runSettings &rs, std::ofstream *myfile = nullptr);
 
     void _mkdir(const char *dir);
 };
@@ -0,0 +1,146 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sampling.h"
+#include "content.h"
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+extern "C" {
+    #include <libswscale/swscale.h>
+}
+
+std::vector<runner::segment> runner::pickSegments(const std::vector<double> &activity, long count, long length)
+{
+    std::vector<segment> picked;
+    long frames = activity.size();
+    if (count <= 0 || length <= 0 || count * length * 3 / 2 > frames)
+        return picked;
+
+    std::vector<long> cuts = sceneCutFrames(activity);
+    std::vector<segment> candidates;
+    auto addCandidate = [&] (long start, bool atCut) {
+        if (start + length > frames)
+            return;
+        segment s;
+        s.start = start;
+        s.frames = length;
+        s.atSceneCut = atCut;
+        // The first frame of a scene differs from the last scene, not from its own content
+        for (long i = start + 1; i < start + length; i++)
+            s.activity += activity.at(i);
+        s.activity /= std::max(1L, length - 1);
+        candidates.push_back(s);
+    };
+    addCandidate(0, true);
+    for (size_t i = 0; i < cuts.size(); i++)
+        addCandidate(cuts.at(i), true);
+    for (long start = length; start + length <= frames; start += length)
+        addCandidate(start, false);
+
+    std::stable_sort(candidates.begin(), candidates.end(), [] (const segment &a, const segment &b) {
+        return a.activity < b.activity;
+    });
+
+    auto overlaps = [&] (const segment &s) -> bool {
+        for (size_t i = 0; i < picked.size(); i++) {
+            if (s.start < picked.at(i).start + picked.at(i).frames && picked.at(i).start < s.start + s.frames)
+                return true;
+        }
+        return false;
+    };
+    for (long stratum = 0; stratum < count; stratum++) {
+        long begin = stratum * candidates.size() / count;
+        long end = (stratum + 1) * candidates.size() / count;
+        long median = (begin + end) / 2;
+        // Walk outwards from the median, taking the first free scene start and else the first free candidate
+        long best = -1;
+        for (long offset = 0; offset < end - begin; offset++) {
+            long tries[2] = {median - offset, median + offset};
+            for (int t = 0; t < 2; t++) {
+                long i = tries[t];
+                if (i < begin || i >= end || overlaps(candidates.at(i)))
+                    continue;
+                if (candidates.at(i).atSceneCut && (best < 0 || !candidates.at(best).atSceneCut))
+                    best = i;
+                else if (best < 0)
+                    best = i;
+            }
+            if (best >= 0 && candidates.at(best).atSceneCut)
+                break;
+        }
+        if (best >= 0)
+            picked.push_back(candidates.at(best));
+    }
+
+    std::sort(picked.begin(), picked.end(), [] (const segment &a, const segment &b) {
+        return a.start < b.start;
+    });
+    return picked;
+}
+
+bool runner::buildSampledReference(const frameStore &source, const std::vector<segment> &segments, const std::string &path, frameStore &sampled, bool hugePages)
+{
+    long total = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+        total += segments.at(i).frames;
+    if (!sampled.create(path, source.width(), source.height(), source.bits(), total, hugePages))
+        return false;
+
+    for (size_t s = 0; s < segments.size(); s++) {
+        for (long i = segments.at(s).start; i < segments.at(s).start + segments.at(s).frames && i < source.frames(); i++) {
+            uint8_t *planes[4];
+            int strides[4];
+            if (!sampled.appendFrame(planes, strides))
+                return false;
+            // Frames are stored contiguously, so a whole frame copies at once
+            memcpy(planes[0], source.frame(i), source.frameSize());
+        }
+    }
+    sampled.finish();
+    return sampled.frames() > 0;
+}
+
+bool runner::buildScaledReference(const frameStore &source, int width, int height, const std::string &path, frameStore &scaled, bool hugePages)
+{
+    enum AVPixelFormat format = AV_PIX_FMT_YUV420P;
+    if (source.bits() == 10)
+        format = AV_PIX_FMT_YUV420P10LE;
+    else if (source.bits() == 12)
+        format = AV_PIX_FMT_YUV420P12LE;
+    if (!scaled.create(path, width, height, source.bits(), source.frames(), hugePages))
+        return false;
+    SwsContext *sws = sws_getContext(source.width(), source.height(), format, width, height, format, SWS_BICUBIC, NULL, NULL, NULL);
+    if (!sws)
+        return false;
+
+    bool ok = true;
+    for (long i = 0; i < source.frames() && ok; i++) {
+        const uint8_t *from[3];
+        int fromStrides[3];
+        uint8_t *to[4];
+        int toStrides[4];
+        source.planes(i, from, fromStrides);
+        ok = scaled.appendFrame(to, toStrides);
+        if (ok)
+            sws_scale(sws, from, fromStrides, 0, source.height(), to, toStrides);
+    }
+    sws_freeContext(sws);
+    scaled.finish();
+    return ok && scaled.frames() > 0;
+}
@@ -0,0 +1,46 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "framestore.h"
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    struct segment {
+        long start = 0;
+        long frames = 0;
+        // Mean frame difference inside the segment
+        double activity = 0;
+        bool atSceneCut = false;
+    };
+
+    // Picks count non overlapping segments of length frames that together look like the whole clip.
+    // Candidates start at scene cuts and on a regular grid, are ranked by activity and split into count
+    // equal strata, and each stratum gives its median candidate, preferring one that starts a scene.
+    // Returns nothing when the clip is too short for sampling to save much.
+    std::vector<segment> pickSegments(const std::vector<double> &activity, long count, long length);
+
+    // Copies the segments one after another into a new store at path
+    bool buildSampledReference(const frameStore &source, const std::vector<segment> &segments, const std::string &path, frameStore &sampled, bool hugePages);
+
+    // Scales every frame of source to width x height into a new store at path
+    bool buildScaledReference(const frameStore &source, int width, int height, const std::string &path, frameStore &scaled, bool hugePages);
+};
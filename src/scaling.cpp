@@ -0,0 +1,120 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scaling.h"
+#include "encoders.h"
+#include "process.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+double runner::scalingModel::speedup(double threads) const
+{
+    if (!valid)
+        return threads;
+    if (threads <= 1)
+        return 1;
+    return 1.0 / (serialFraction + (1.0 - serialFraction) / threads);
+}
+
+void runner::tileLayout(int threads, int width, int height, int &log2Cols, int &log2Rows)
+{
+    int log2Threads = 0;
+    while ((2 << log2Threads) <= threads)
+        log2Threads++;
+
+    log2Cols = 0;
+    while (log2Cols < log2Threads && log2Cols < 6 && (width >> (log2Cols + 1)) >= 256)
+        log2Cols++;
+    log2Rows = 0;
+    while (log2Cols + log2Rows < log2Threads && log2Rows < 6 && (height >> (log2Rows + 1)) >= 256)
+        log2Rows++;
+}
+
+runner::scalingModel runner::fitScalingModel(const std::vector<scalingPoint> &points)
+{
+    scalingModel model;
+    model.points = points;
+
+    // time = a + b / threads, then serial = a / (a + b)
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (points.at(i).threads < 1 || points.at(i).seconds <= 0)
+            continue;
+        double x = 1.0 / points.at(i).threads;
+        double y = points.at(i).seconds;
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double denominator = n * sxx - sx * sx;
+    if (n < 2 || denominator <= 0)
+        return model;
+
+    double b = (n * sxy - sx * sy) / denominator;
+    double a = (sy - b * sx) / n;
+    if (a + b <= 0)
+        return model;
+
+    model.serialFraction = std::max(0.0, std::min(1.0, a / (a + b)));
+    model.valid = true;
+    return model;
+}
+
+runner::scalingModel runner::measureScaling(const runSettings &rs, const singleRun &base, int maxThreads)
+{
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(std::max(1, maxThreads));
+
+    // A few seconds from the middle of the video is enough to see how the encoder scales
+    long frames = std::min(rs.videoFrames, std::max(30L, (long) (3.0 * rs.videoFPSNum / rs.videoFPSDenom)));
+
+    if (!prepareEncoderInput(rs)) {
+        std::cout << "Unable to write the y4m copy of the reference for the scaling benchmark, exiting." << std::endl;
+        exit(1);
+    }
+    std::vector<scalingPoint> points;
+    std::cout << "Threads, Seconds, Speedup" << std::endl;
+    for (size_t i = 0; i < threadCounts.size(); i++) {
+        singleRun sr = base;
+        sr.threads = threadCounts.at(i);
+        sr.frameOffset = (rs.videoFrames - frames) / 2;
+        sr.frameLimit = frames;
+        std::string cmd = encoderCommand(sr, rs, "", "/dev/null", 0);
+
+        processUsage usage;
+        auto start = std::chrono::steady_clock::now();
+        if (runCommand(cmd, usage) != 0) {
+            std::cout << "Error running " << rs.encodingProgram << " for the scaling benchmark, exiting." << std::endl;
+            exit(1);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        scalingPoint p;
+        p.threads = sr.threads;
+        p.seconds = elapsed.count();
+        points.push_back(p);
+        std::cout << p.threads << ", " << p.seconds << ", " << points.front().seconds / p.seconds << std::endl;
+    }
+
+    return fitScalingModel(points);
+}
@@ -0,0 +1,50 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <vector>
+
+namespace runner
+{
+    struct scalingPoint {
+        int threads = 1;
+        double seconds = 0;
+    };
+
+    // Amdahl model of how an encode speeds up with threads: time(n) = time(1) * (serial + (1 - serial) / n).
+    // Without a fit it falls back to linear scaling, the old -P behaviour.
+    struct scalingModel {
+        bool valid = false;
+        double serialFraction = 0;
+        std::vector<scalingPoint> points;
+
+        double speedup(double threads) const;
+    };
+
+    // Picks log2 tile columns and rows for a thread count, columns first, keeping tiles at least 256 pixels
+    void tileLayout(int threads, int width, int height, int &log2Cols, int &log2Rows);
+
+    // Least squares fit of the wall times against 1 / threads. Needs at least two thread counts.
+    scalingModel fitScalingModel(const std::vector<scalingPoint> &points);
+
+    // Encodes a short segment from the middle of the reference at 1, 2, 4 ... maxThreads threads with matching
+    // tiles and row-mt and fits the model to the wall times. base gives the rate and speed settings to use.
+    scalingModel measureScaling(const runSettings &rs, const singleRun &base, int maxThreads);
+};
@@ -0,0 +1,73 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+runner::trialScheduler::trialScheduler(const runSettings &rs, const frameStore *reference) :
+    rs(rs), workerSlots(rs.jobs > 0 ? rs.jobs : 1), trialCounter(0), reference(reference),
+    passCache(rs.temporaryStorageLocation + "/firstpass")
+{
+}
+
+runner::trialContext runner::trialScheduler::nextContext()
+{
+    trialContext ctx;
+    ctx.trialNumber = trialCounter++;
+    ctx.workDir = rs.temporaryStorageLocation + "/trial" + std::to_string(ctx.trialNumber);
+    ctx.passCache = &passCache;
+    ctx.reference = reference;
+    return ctx;
+}
+
+void runner::trialScheduler::run(std::vector<singleRun> &batch, std::vector<std::string> &commands)
+{
+    commands.assign(batch.size(), "");
+    std::vector<trialContext> contexts;
+    for (size_t i = 0; i < batch.size(); i++) {
+        contexts.push_back(nextContext());
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&] () {
+        size_t i;
+        while ((i = next++) < batch.size()) {
+            commands.at(i) = runSim(batch.at(i), rs, contexts.at(i));
+        }
+    };
+
+    size_t threadCount = std::min(batch.size(), (size_t) workerSlots);
+    if (threadCount <= 1) {
+        worker();
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads.at(i).join();
+    }
+}
+
+std::string runner::trialScheduler::run(singleRun &sr)
+{
+    return runSim(sr, rs, nextContext());
+}
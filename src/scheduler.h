@@ -0,0 +1,56 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "passcache.h"
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Runs batches of independent trials on up to rs.jobs worker threads.
+    // Every trial gets its own scratch directory under temporaryStorageLocation so the encoder output,
+    // decoded output and pass file of one trial never collide with another.
+    class trialScheduler {
+    public:
+        trialScheduler(const runSettings &rs, const frameStore *reference);
+
+        // Runs every trial in batch and fills in its results. batch keeps its order, and
+        // commands[i] is the encoder command line for batch[i], so callers can merge the results
+        // into runsList deterministically no matter which trial finished first.
+        void run(std::vector<singleRun> &batch, std::vector<std::string> &commands);
+
+        // Runs a single trial, for searches where every probe depends on the previous one.
+        std::string run(singleRun &sr);
+
+        int slots() const { return workerSlots; }
+
+        // A scratch directory and the shared caches for a trial run outside the scheduler
+        trialContext nextContext();
+
+    private:
+
+        runSettings rs;
+        int workerSlots;
+        long trialCounter;
+        const frameStore *reference;
+        firstPassCache passCache;
+    };
+};
@@ -0,0 +1,272 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "surrogate.h"
+#include "encoders.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+    const long surrogatePassNumber = 5;
+    // Stop once no candidate is expected to improve the objective by more than this, about half a percent
+    const double improvementTolerance = 0.005;
+}
+
+runner::surrogateOptimizer::surrogateOptimizer(const runSettings &rs, const paramSweep &sweep, trialScheduler &scheduler, double coreSpeedup) :
+    rs(rs), scheduler(scheduler), searched(sweep.searchedDimensions()), startRate(1), encodeCount(0)
+{
+    paramPoint p = sweep.first();
+    points.push_back(p);
+    while (sweep.next(p, p))
+        points.push_back(p);
+
+    if (rs.useCPUTime)
+        maxTime = rs.videoLength * coreSpeedup / rs.timescaleTarget;
+    else
+        maxTime = rs.videoLength / rs.timescaleTarget;
+}
+
+double runner::surrogateOptimizer::rateOf(const singleRun &sr) const
+{
+    return rs.useQFactor ? sr.qFactor : sr.bitrate;
+}
+
+double runner::surrogateOptimizer::timeOf(const singleRun &sr) const
+{
+    return rs.useCPUTime ? sr.netCpuTime : sr.realTime;
+}
+
+std::vector<double> runner::surrogateOptimizer::features(const paramPoint &params, double rate) const
+{
+    // Everything is scaled to roughly 0-1 so one grid of length scales suits every input
+    std::vector<double> x;
+    if (rs.useQFactor)
+        x.push_back(rate / encoderFor(rs).maxQuality());
+    else
+        x.push_back(std::log2(std::max(1.0, rate) / startRate) / 4.0 + 0.5);
+
+    const parameterSpace &space = encoderFor(rs).parameters();
+    for (size_t i = 0; i < searched.size(); i++) {
+        int d = searched.at(i);
+        int size = space.dimensions().at(d).values.size();
+        x.push_back(size > 1 ? (double) std::max(0, params.values.at(d)) / (size - 1) : 0);
+    }
+    return x;
+}
+
+double runner::surrogateOptimizer::objective(double logSize, double logTime) const
+{
+    if (rs.targetTimeRatio && rs.timeCostRatio > 0)
+        return logTime + std::log2(rs.timeCostRatio) * logSize;
+    return logSize;
+}
+
+bool runner::surrogateOptimizer::feasible(const singleRun &sr) const
+{
+    // A proxy estimate or a stopped trial can not be the answer, and a subsampled score only counts once its whole
+    // interval clears the bar
+    if (sr.proxyScored || sr.tooSlow)
+        return false;
+    if (sr.vmafLow < rs.vmafTarget - rs.vmafEpsilon || sr.videoSize <= 0)
+        return false;
+    if (!rs.targetTimeRatio && timeOf(sr) > maxTime)
+        return false;
+    return true;
+}
+
+long runner::surrogateOptimizer::best(const std::vector<singleRun> &runsList) const
+{
+    long bestIndex = -1;
+    double bestObjective = 0;
+    for (size_t i = 0; i < runsList.size(); i++) {
+        const singleRun &sr = runsList.at(i);
+        if (!feasible(sr) || timeOf(sr) <= 0)
+            continue;
+        double o = objective(std::log((double) sr.videoSize), std::log(timeOf(sr)));
+        if (bestIndex < 0 || o < bestObjective) {
+            bestIndex = i;
+            bestObjective = o;
+        }
+    }
+    return bestIndex;
+}
+
+void runner::surrogateOptimizer::runBatch(std::vector<singleRun> &batch, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv)
+{
+    std::vector<std::string> commands;
+    scheduler.run(batch, commands);
+    encodeCount += batch.size();
+    for (size_t b = 0; b < batch.size(); b++) {
+        runsList.push_back(batch.at(b));
+        commandList.push_back(commands.at(b));
+        printResult(batch.at(b), rs, csv);
+    }
+}
+
+bool runner::surrogateOptimizer::optimize(double rate, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv, size_t &bestIndex)
+{
+    startRate = std::max(1.0, rate);
+
+    // Pass 1 only covers the fastest settings, so seed the model with the slowest and the middle of the sweep
+    std::vector<singleRun> seeds;
+    std::vector<size_t> seedPoints;
+    seedPoints.push_back(points.size() - 1);
+    if (points.size() > 2)
+        seedPoints.push_back(points.size() / 2);
+    for (size_t i = 0; i < seedPoints.size(); i++) {
+        singleRun sr;
+        sr.params = points.at(seedPoints.at(i));
+        sr.optimizationPassNumber = surrogatePassNumber;
+        sr.scoreTarget = rs.vmafTarget;
+        sr.scoreEpsilon = rs.vmafEpsilon;
+        sr.bitrate = rate;
+        sr.qFactor = (int) rate;
+        seeds.push_back(sr);
+    }
+    runBatch(seeds, runsList, commandList, csv);
+
+    // Candidate rates around the pass 1 result
+    std::vector<double> rates;
+    if (rs.useQFactor) {
+        // About 22 quantizers over the backend's whole range, the ends included
+        int maxQ = encoderFor(rs).maxQuality();
+        int step = std::max(1, (maxQ + 20) / 21);
+        for (int q = 0; q <= maxQ; q += step)
+            rates.push_back(q);
+        if (rates.back() != maxQ)
+            rates.push_back(maxQ);
+    } else {
+        for (int k = -8; k <= 8; k++)
+            rates.push_back(std::round(startRate * std::pow(2.0, k / 4.0)));
+    }
+
+    while (encodeCount < rs.surrogateBudget) {
+        std::vector<std::vector<double> > x;
+        std::vector<double> vmafs, logSizes, logTimes;
+        for (size_t i = 0; i < runsList.size(); i++) {
+            const singleRun &sr = runsList.at(i);
+            // A proxy scored vmaf is an estimate and a stopped trial has no real size or time, neither belongs in the fit
+            if (sr.proxyScored || sr.tooSlow || sr.videoSize <= 0 || timeOf(sr) <= 0 || sr.params.values.empty())
+                continue;
+            x.push_back(features(sr.params, rateOf(sr)));
+            vmafs.push_back(sr.vmaf);
+            logSizes.push_back(std::log((double) sr.videoSize));
+            logTimes.push_back(std::log(timeOf(sr)));
+        }
+        gaussianProcess vmafModel, sizeModel, timeModel;
+        if (!vmafModel.fit(x, vmafs) || !sizeModel.fit(x, logSizes) || !timeModel.fit(x, logTimes)) {
+            std::cout << "Unable to fit the surrogate model" << std::endl;
+            break;
+        }
+
+        long incumbent = best(runsList);
+        double bestObjective = 0;
+        if (incumbent >= 0)
+            bestObjective = objective(std::log((double) runsList.at(incumbent).videoSize), std::log(timeOf(runsList.at(incumbent))));
+
+        struct candidate {
+            double score;
+            size_t point;
+            double rate;
+        };
+        std::vector<candidate> candidates;
+        double timeWeight = (rs.targetTimeRatio && rs.timeCostRatio > 0) ? 1.0 : 0.0;
+        double sizeWeight = (rs.targetTimeRatio && rs.timeCostRatio > 0) ? std::log2(rs.timeCostRatio) : 1.0;
+        for (size_t p = 0; p < points.size(); p++) {
+            // Besides the grid, try the rate the model expects to land exactly on the target
+            std::vector<double> pointRates = rates;
+            double lo = rates.front(), hi = rates.back();
+            for (int step = 0; step < 20; step++) {
+                double mid = rs.useQFactor ? (lo + hi) / 2 : std::sqrt(lo * hi);
+                double mv, vv;
+                vmafModel.predict(features(points.at(p), mid), mv, vv);
+                // vmaf falls as cq-level rises but grows with bitrate
+                if ((mv < rs.vmafTarget) != rs.useQFactor)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            pointRates.push_back(std::round(rs.useQFactor ? (lo + hi) / 2 : std::sqrt(lo * hi)));
+
+            for (size_t r = 0; r < pointRates.size(); r++) {
+                bool tried = false;
+                for (size_t i = 0; i < runsList.size() && !tried; i++)
+                    tried = runsList.at(i).params == points.at(p) && (int) rateOf(runsList.at(i)) == (int) pointRates.at(r);
+                if (tried)
+                    continue;
+
+                std::vector<double> xc = features(points.at(p), pointRates.at(r));
+                double mv, vv, ms, vs, mt, vt;
+                vmafModel.predict(xc, mv, vv);
+                sizeModel.predict(xc, ms, vs);
+                timeModel.predict(xc, mt, vt);
+
+                double pFeasible = normalCdf((mv - (rs.vmafTarget - rs.vmafEpsilon)) / std::sqrt(vv));
+                if (!rs.targetTimeRatio)
+                    pFeasible *= normalCdf((std::log(maxTime) - mt) / std::sqrt(vt));
+
+                double score;
+                if (incumbent < 0) {
+                    // Nothing feasible yet, go where it is most likely to be
+                    score = pFeasible;
+                } else {
+                    double mean = timeWeight * mt + sizeWeight * ms;
+                    double sd = std::sqrt(timeWeight * timeWeight * vt + sizeWeight * sizeWeight * vs);
+                    double z = (bestObjective - mean) / sd;
+                    score = ((bestObjective - mean) * normalCdf(z) + sd * normalPdf(z)) * pFeasible;
+                }
+                candidate c;
+                c.score = score;
+                c.point = p;
+                c.rate = pointRates.at(r);
+                candidates.push_back(c);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [] (const candidate &a, const candidate &b) { return a.score > b.score; });
+
+        bool onTarget = incumbent >= 0 && withinTarget(runsList.at(incumbent), rs.vmafTarget, rs.vmafEpsilon);
+        if (candidates.empty() || (onTarget && candidates.front().score < improvementTolerance))
+            break;
+
+        // One candidate per parameter point each round keeps a batch from piling onto one spot
+        std::vector<singleRun> batch;
+        for (size_t i = 0; i < candidates.size() && (int) batch.size() < scheduler.slots() && encodeCount + (long) batch.size() < rs.surrogateBudget; i++) {
+            bool samePoint = false;
+            for (size_t b = 0; b < batch.size(); b++)
+                samePoint = samePoint || batch.at(b).params == points.at(candidates.at(i).point);
+            if (samePoint)
+                continue;
+            singleRun sr;
+            sr.params = points.at(candidates.at(i).point);
+            sr.optimizationPassNumber = surrogatePassNumber;
+            sr.scoreTarget = rs.vmafTarget;
+            sr.scoreEpsilon = rs.vmafEpsilon;
+            sr.bitrate = candidates.at(i).rate;
+            sr.qFactor = candidates.at(i).rate;
+            batch.push_back(sr);
+        }
+        runBatch(batch, runsList, commandList, csv);
+    }
+
+    long incumbent = best(runsList);
+    if (incumbent < 0)
+        return false;
+    bestIndex = incumbent;
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "gp.h"
+#include "scheduler.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Replaces the sequential passes with a surrogate model of every encode so far. Gaussian processes over
+    // the rate and the searched encoder parameters predict vmaf, log size and log time, and each round
+    // encodes the candidates with the highest expected improvement of the objective, weighted by the
+    // probability that they reach the vmaf target and, for -t, the timescale.
+    // The objective is log size for -t, or log time + log2(-T) * log size for -T.
+    class surrogateOptimizer {
+    public:
+        // coreSpeedup is how much faster than one core the target machine encodes, for the -t check
+        surrogateOptimizer(const runSettings &rs, const paramSweep &sweep, trialScheduler &scheduler, double coreSpeedup);
+
+        // Runs until the best encode is within epsilon of the target and no candidate is expected to improve on it
+        // by much, or rs.surrogateBudget encodes have been spent. Returns false if it found nothing usable,
+        // otherwise bestIndex is the index of the recommended encode in runsList.
+        bool optimize(double startRate, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv, size_t &bestIndex);
+
+        long encodes() const { return encodeCount; }
+
+    private:
+        std::vector<double> features(const paramPoint &params, double rate) const;
+        double rateOf(const singleRun &sr) const;
+        double timeOf(const singleRun &sr) const;
+        double objective(double logSize, double logTime) const;
+        bool feasible(const singleRun &sr) const;
+        // Index into runsList of the best feasible encode, or -1
+        long best(const std::vector<singleRun> &runsList) const;
+        void runBatch(std::vector<singleRun> &batch, std::vector<singleRun> &runsList, std::vector<std::string> &commandList, std::ofstream *csv);
+
+        const runSettings &rs;
+        trialScheduler &scheduler;
+        std::vector<paramPoint> points;
+        std::vector<int> searched;
+        double startRate;
+        double maxTime;
+        long encodeCount;
+    };
+};
@@ -0,0 +1,153 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timing.h"
+#include "process.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace {
+    // Two sided 95% quantiles of Student's t for 1 to 30 degrees of freedom
+    const double tQuantiles[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+    void statsColumns(std::stringstream &row, const runner::timingStats &t)
+    {
+        row << ", " << t.stddev << ", " << (t.high - t.low) / 2;
+    }
+}
+
+runner::timingStats runner::summarize(const std::vector<double> &samples)
+{
+    timingStats t;
+    size_t n = samples.size();
+    if (n == 0)
+        return t;
+    for (size_t i = 0; i < n; i++)
+        t.mean += samples.at(i);
+    t.mean /= n;
+    t.low = t.mean;
+    t.high = t.mean;
+    if (n < 2)
+        return t;
+    double squares = 0;
+    for (size_t i = 0; i < n; i++)
+        squares += (samples.at(i) - t.mean) * (samples.at(i) - t.mean);
+    t.stddev = std::sqrt(squares / (n - 1));
+    double halfWidth = (n - 1 <= 30 ? tQuantiles[n - 2] : 1.96) * t.stddev / std::sqrt((double) n);
+    t.low = t.mean - halfWidth;
+    t.high = t.mean + halfWidth;
+    return t;
+}
+
+void runner::repeatTiming(singleRun &sr, const runSettings &rs, const trialContext &ctx, const std::atomic<bool> *cancel)
+{
+    if (!sr.timeRepeats || rs.timingPrecision <= 0 || sr.tooSlow)
+        return;
+
+    // The scored run shares the cpu with its decoder and scorer, so only the repeats are timed. They run both
+    // passes again, so they skip the pass cache, and they have no budget since the first run fit in it.
+    trialContext again = ctx;
+    again.passCache = nullptr;
+    std::vector<double> p1, p2, net, real;
+    int maxRuns = std::max(3, rs.timingMaxRuns);
+    while ((int) net.size() < maxRuns) {
+        singleRun repeat = sr;
+        repeat.timeBudget = 0;
+        encodeTrial(repeat, rs, again, [] (const uint8_t *, size_t, int64_t) {}, cancel);
+        if ((cancel && *cancel) || repeat.tooSlow)
+            return;
+        p1.push_back(repeat.cpuTimeP1);
+        p2.push_back(repeat.cpuTimeP2);
+        net.push_back(repeat.netCpuTime);
+        real.push_back(repeat.realTime);
+
+        timingStats deciding = summarize(rs.useCPUTime ? net : real);
+        if (net.size() >= 3 && deciding.high - deciding.low < rs.timingPrecision * deciding.mean)
+            break;
+    }
+
+    sr.timingRuns = net.size();
+    sr.cpuP1Stats = summarize(p1);
+    sr.cpuP2Stats = summarize(p2);
+    sr.netCpuStats = summarize(net);
+    sr.realStats = summarize(real);
+    sr.cpuTimeP1 = sr.cpuP1Stats.mean;
+    sr.cpuTimeP2 = sr.cpuP2Stats.mean;
+    sr.netCpuTime = sr.netCpuStats.mean;
+    sr.realTime = sr.realStats.mean;
+    const timingStats &deciding = rs.useCPUTime ? sr.netCpuStats : sr.realStats;
+    if (deciding.high - deciding.low >= rs.timingPrecision * deciding.mean)
+        std::cout << "Timing did not settle within " << 100 * rs.timingPrecision << "% after " << sr.timingRuns << " runs" << std::endl;
+}
+
+std::string runner::cpuGovernor(int cpu)
+{
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/scaling_governor");
+    std::string governor;
+    in >> governor;
+    return governor;
+}
+
+void runner::prepareTiming(const runSettings &rs)
+{
+    std::vector<int> cpus;
+    if (!rs.pinCpus.empty()) {
+        if (!pinCommands(rs.pinCpus, cpus)) {
+            std::cout << "Unable to parse the cpu list " << rs.pinCpus << std::endl;
+            exit(1);
+        }
+        std::cout << "Pinning encoders to cpus " << rs.pinCpus << std::endl;
+        if (rs.jobs > (int) cpus.size())
+            std::cout << "WARNING. " << rs.jobs << " trials at once share " << cpus.size() << " cpus, their timings will disturb each other" << std::endl;
+    } else {
+        for (int c = 0; c < (int) std::thread::hardware_concurrency(); c++)
+            cpus.push_back(c);
+    }
+
+    // Anything but the performance governor lets the clock follow the load, which shows up as timing noise
+    std::string slow;
+    for (size_t i = 0; i < cpus.size(); i++) {
+        std::string governor = cpuGovernor(cpus.at(i));
+        if (!governor.empty() && governor != "performance")
+            slow += (slow.empty() ? "" : ",") + std::to_string(cpus.at(i)) + " (" + governor + ")";
+    }
+    if (!slow.empty())
+        std::cout << "WARNING. The frequency governor of cpus " << slow << " is not performance, encode times will vary with the clock" << std::endl;
+}
+
+std::string runner::timingCsvHeader()
+{
+    return ", TimingRuns, Pass1CTimeSD, Pass1CTimeCI, Pass2CTimeSD, Pass2CTimeCI, NetCTimeSD, NetCTimeCI, NetRTSD, NetRTCI";
+}
+
+std::string runner::timingCsvRow(const singleRun &sr)
+{
+    std::stringstream row;
+    row << ", " << sr.timingRuns;
+    statsColumns(row, sr.cpuP1Stats);
+    statsColumns(row, sr.cpuP2Stats);
+    statsColumns(row, sr.netCpuStats);
+    statsColumns(row, sr.realStats);
+    return row.str();
+}
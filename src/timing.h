@@ -0,0 +1,44 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace runner
+{
+    // Re-runs the encode of a trial with timeRepeats set, throwing the output away, until the 95% interval of the
+    // time that decides its speed (cpu or real) is narrower than rs.timingPrecision of its mean or rs.timingMaxRuns
+    // measurements were taken. The trial's times become the means and its size and scores are left alone.
+    void repeatTiming(singleRun &sr, const runSettings &rs, const trialContext &ctx, const std::atomic<bool> *cancel = nullptr);
+
+    // Mean, standard deviation and 95% interval of every measurement
+    timingStats summarize(const std::vector<double> &samples);
+
+    // Governor of a cpu's frequency scaling, empty if it cannot be read
+    std::string cpuGovernor(int cpu);
+
+    // Pins the encoders to rs.pinCpus if set and warns about cpus whose frequency is not fixed at its highest
+    void prepareTiming(const runSettings &rs);
+
+    std::string timingCsvHeader();
+    std::string timingCsvRow(const singleRun &sr);
+};
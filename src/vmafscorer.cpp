@@ -0,0 +1,197 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "vmafscorer.h"
+#include "framestore.h"
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+namespace {
+    // Copies one plane into a libvmaf picture, shifting samples when the bit depths differ
+    template <typename S, typename D>
+    void copyPlane(const uint8_t *src, int srcStride, int srcBits, void *dst, ptrdiff_t dstStride, int dstBits, unsigned w, unsigned h)
+    {
+        for (unsigned y = 0; y < h; y++) {
+            const S *s = (const S *) (src + y * srcStride);
+            D *d = (D *) ((uint8_t *) dst + y * dstStride);
+            if (dstBits >= srcBits) {
+                int shift = dstBits - srcBits;
+                for (unsigned x = 0; x < w; x++)
+                    d[x] = (D) (s[x] << shift);
+            } else {
+                int shift = srcBits - dstBits;
+                for (unsigned x = 0; x < w; x++)
+                    d[x] = (D) (s[x] >> shift);
+            }
+        }
+    }
+
+    void copyPicture(const uint8_t *const src[3], const int srcStride[3], int srcBits, VmafPicture &pic)
+    {
+        for (int p = 0; p < 3; p++) {
+            if (srcBits > 8 && pic.bpc > 8)
+                copyPlane<uint16_t, uint16_t>(src[p], srcStride[p], srcBits, pic.data[p], pic.stride[p], pic.bpc, pic.w[p], pic.h[p]);
+            else if (srcBits > 8)
+                copyPlane<uint16_t, uint8_t>(src[p], srcStride[p], srcBits, pic.data[p], pic.stride[p], pic.bpc, pic.w[p], pic.h[p]);
+            else if (pic.bpc > 8)
+                copyPlane<uint8_t, uint16_t>(src[p], srcStride[p], srcBits, pic.data[p], pic.stride[p], pic.bpc, pic.w[p], pic.h[p]);
+            else
+                copyPlane<uint8_t, uint8_t>(src[p], srcStride[p], srcBits, pic.data[p], pic.stride[p], pic.bpc, pic.w[p], pic.h[p]);
+        }
+    }
+
+    // Percentile interval of the mean of scores over resamples with replacement. The seed is fixed so the same
+    // scores always get the same interval.
+    void bootstrapInterval(const std::vector<double> &scores, double &low, double &high)
+    {
+        const int resamples = 500;
+        std::mt19937 rng(12345);
+        std::uniform_int_distribution<size_t> pick(0, scores.size() - 1);
+        std::vector<double> means(resamples);
+        for (int b = 0; b < resamples; b++) {
+            double sum = 0;
+            for (size_t i = 0; i < scores.size(); i++)
+                sum += scores.at(pick(rng));
+            means.at(b) = sum / scores.size();
+        }
+        std::sort(means.begin(), means.end());
+        low = means.at((size_t) (0.025 * (resamples - 1)));
+        high = means.at((size_t) (0.975 * (resamples - 1)));
+    }
+}
+
+runner::vmafScorer::vmafScorer(const runSettings &rs, int subsample) :
+    subsample(subsample > 1 ? subsample : 1), width(rs.xRes), height(rs.yRes), bits(rs.bits)
+{
+    VmafConfiguration cfg;
+    cfg.log_level = VMAF_LOG_LEVEL_NONE;
+    cfg.n_threads = rs.vmafThreads > 0 ? rs.vmafThreads : 0;
+    cfg.n_subsample = subsample > 1 ? subsample : 0;
+    cfg.cpumask = 0;
+    if (vmaf_init(&vmaf, cfg) < 0) {
+        std::cout << "Unable to initialize libvmaf" << std::endl;
+        vmaf = nullptr;
+        return;
+    }
+
+    // -V takes either a model file or the name of a model built into libvmaf
+    VmafModelConfig modelCfg;
+    modelCfg.name = "vmaf";
+    modelCfg.flags = 0;
+    if (vmaf_model_load_from_path(&model, &modelCfg, rs.vmafModel.c_str()) < 0 &&
+            vmaf_model_load(&model, &modelCfg, rs.vmafModel.c_str()) < 0) {
+        std::cout << "Unable to load VMAF model " << rs.vmafModel << std::endl;
+        model = nullptr;
+        return;
+    }
+    if (vmaf_use_features_from_model(vmaf, model) < 0) {
+        std::cout << "Unable to load the features used by VMAF model " << rs.vmafModel << std::endl;
+        vmaf_model_destroy(model);
+        model = nullptr;
+    }
+}
+
+runner::vmafScorer::~vmafScorer()
+{
+    if (model)
+        vmaf_model_destroy(model);
+    if (vmaf)
+        vmaf_close(vmaf);
+}
+
+void runner::vmafScorer::addFrame(const uint8_t *const ref[3], const int refStride[3], int refBits,
+                                  const uint8_t *const dist[3], const int distStride[3], int distBits)
+{
+    if (!good())
+        return;
+
+    VmafPicture refPic, distPic;
+    if (vmaf_picture_alloc(&refPic, VMAF_PIX_FMT_YUV420P, bits, width, height) < 0)
+        return;
+    if (vmaf_picture_alloc(&distPic, VMAF_PIX_FMT_YUV420P, bits, width, height) < 0) {
+        vmaf_picture_unref(&refPic);
+        return;
+    }
+    copyPicture(ref, refStride, refBits, refPic);
+    copyPicture(dist, distStride, distBits, distPic);
+
+    // libvmaf takes ownership of both pictures
+    if (vmaf_read_pictures(vmaf, &refPic, &distPic, frameCount) < 0) {
+        std::cout << "libvmaf rejected frame " << frameCount << std::endl;
+        return;
+    }
+    frameCount++;
+}
+
+runner::vmafResult runner::vmafScorer::finish()
+{
+    vmafResult result;
+    if (!good() || frameCount == 0)
+        return result;
+
+    vmaf_read_pictures(vmaf, NULL, NULL, 0);
+    vmaf_score_pooled(vmaf, model, VMAF_POOL_METHOD_MEAN, &result.pooled, 0, frameCount - 1);
+    vmaf_score_pooled(vmaf, model, VMAF_POOL_METHOD_MIN, &result.min, 0, frameCount - 1);
+
+    // Pooling already skips the frames libvmaf did not score
+    for (unsigned i = 0; i < frameCount; i += subsample) {
+        double score = 0;
+        vmaf_score_at_index(vmaf, model, &score, i);
+        result.frames.push_back(score);
+    }
+    return result;
+}
+
+runner::trialScorer::trialScorer(const runSettings &rs, const singleRun &sr, const frameStore *reference, int step) :
+    proxy(rs.xRes, rs.yRes, rs.bits), reference(reference), bits(rs.bits), index(sr.frameOffset), subsampled(step > 1)
+{
+    if (!sr.proxyScored)
+        vmaf.reset(new vmafScorer(rs, step));
+}
+
+void runner::trialScorer::addFrame(const AVFrame *frame)
+{
+    if (index < reference->frames()) {
+        const uint8_t *refPlanes[3];
+        int refStride[3];
+        reference->planes(index, refPlanes, refStride);
+        if (vmaf)
+            vmaf->addFrame(refPlanes, refStride, reference->bits(), frame->data, frame->linesize, bits);
+        proxy.addFrame(refPlanes, refStride, reference->bits(), frame->data, frame->linesize, bits);
+    }
+    index++;
+}
+
+void runner::trialScorer::finish(singleRun &sr)
+{
+    proxyResult proxyScore = proxy.finish();
+    sr.psnr = proxyScore.psnr;
+    sr.ssim = proxyScore.ssim;
+    if (!vmaf)
+        return;
+
+    vmafResult score = vmaf->finish();
+    sr.vmaf = score.pooled;
+    sr.vmafMin = score.min;
+    sr.vmafFrames = score.frames;
+    sr.vmafLow = score.pooled;
+    sr.vmafHigh = score.pooled;
+    if (subsampled && score.frames.size() > 1)
+        bootstrapInterval(score.frames, sr.vmafLow, sr.vmafHigh);
+}
@@ -0,0 +1,86 @@
+/*
+ * SCV - An automatic video analysis tool
+ * Copyright (C) 2020  Eli Stone eli.stonium@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "runner.h"
+#include "proxymetric.h"
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+extern "C" {
+    #include <libvmaf/libvmaf.h>
+}
+
+namespace runner
+{
+    struct vmafResult {
+        double pooled = 0;
+        double min = 0;
+        std::vector<double> frames;
+    };
+
+    // Scores frames in process with libvmaf.
+    // Frames are planar yuv420 at the test resolution; samples wider than 8 bits are stored in 16 bit words.
+    // With subsample above 1 every frame still has to be added, so the motion feature sees consecutive frames,
+    // but only every subsample-th one is scored.
+    class vmafScorer {
+    public:
+        vmafScorer(const runSettings &rs, int subsample = 1);
+        ~vmafScorer();
+
+        bool good() const { return vmaf != nullptr && model != nullptr; }
+
+        void addFrame(const uint8_t *const ref[3], const int refStride[3], int refBits,
+                      const uint8_t *const dist[3], const int distStride[3], int distBits);
+
+        // Flushes libvmaf and returns the pooled (mean) and per frame scores of the scored frames.
+        vmafResult finish();
+
+    private:
+        VmafContext *vmaf = nullptr;
+        VmafModel *model = nullptr;
+        unsigned frameCount = 0;
+        unsigned subsample;
+        int width;
+        int height;
+        int bits;
+    };
+
+    // Scores the decoded frames of one trial against the reference, starting at its frameOffset. vmaf is skipped for
+    // proxy scored trials, psnr and ssim see every frame. A subsampled vmaf lets libvmaf score every step-th frame.
+    class trialScorer {
+    public:
+        trialScorer(const runSettings &rs, const singleRun &sr, const frameStore *reference, int step);
+
+        void addFrame(const AVFrame *frame);
+        bool good() const { return vmaf ? vmaf->good() : proxy.good(); }
+
+        // Fills in the scores of sr. Subsampled vmaf gets a 95% bootstrap interval, otherwise the interval is the score.
+        void finish(singleRun &sr);
+
+    private:
+        std::unique_ptr<vmafScorer> vmaf;
+        proxyScorer proxy;
+        const frameStore *reference;
+        int bits;
+        long index;
+        bool subsampled;
+    };
+};